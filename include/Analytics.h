@@ -0,0 +1,240 @@
+// Analytics step
+// What the analytics task does with the samples: integrate every one of
+// them, apply the charge to the SOC every SOC_CALC_INTERVAL_MS, decide when
+// the SOC needs saving, and log a point every log interval. The firmware
+// runs it from the analytics task and the native simulator from its trace
+// replay, so both share the code and the constants below.
+//
+// Saving is split in two: the step only marks the SOC dirty (through its
+// AnalyticsSink), and PersistSchedule decides when the marks become a flash
+// write, coalescing routine changes into one write per
+// PERSIST_SOC_INTERVAL_MS.
+
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <atomic>
+#include "Hal.h"
+#include "SampleRing.h"
+#include "CoulombCounter.h"
+#include "SocTracker.h"
+#include "HistoryStore.h"
+#include "TimeBase.h"
+
+// Battery specifications (capacity configurable via web UI)
+#define DEFAULT_CAPACITY_AH 300.0  // User configurable, kept by socTracker
+#define PEUKERT_EXPONENT 1.1       // Peukert exponent for lead acid (typically 1.05-1.4)
+// C20_RATE calculated as capacity / 20.0 at runtime
+#define FULL_VOLTAGE_THRESHOLD 13.8  // Voltage threshold for "full" detection
+#define FULL_DETECTION_TIME 60000    // Must meet criteria for 60 seconds
+
+// SOC calculation settings
+#define SOC_CALC_INTERVAL_MS 10000   // Apply integrated charge to SOC every 10 seconds
+#define SOC_SAVE_CHANGE 0.5          // Mark the SOC for saving when it moves this far (%)...
+#define SOC_SAVE_INTERVAL_MS 600000  // ...or at least this often
+#define PERSIST_SOC_INTERVAL_MS 60000  // Routine SOC changes are written at most once a minute
+#define INTEGRATE_BATCH 32           // Samples copied out of the ring at a time
+
+// Data logging settings
+#define DEFAULT_LOG_INTERVAL_MINUTES 10  // User configurable
+#define MAX_DATA_POINTS 864  // 6 days at 10-minute intervals (144*6), 5 bytes each (PackedPoint.h)
+#define MAX_TIME_ANCHORS 64  // Interval changes and reboots covered by the raw history
+
+// Flash logs: append-only segments, the oldest is recycled when all are full.
+// One segment more than needed to hold MAX_DATA_POINTS, so a rotation never
+// drops points that are still in the RAM ring.
+#define LOG_SEGMENT_DIR "/log"
+#define LOG_SEGMENT_COUNT 4
+#define LOG_RECORDS_PER_SEGMENT (MAX_DATA_POINTS / (LOG_SEGMENT_COUNT - 1))
+#define ANCHOR_SEGMENT_DIR "/log/anchor"
+
+// Raw points are delta coded on flash (~1 KB per segment), so the flash log
+// keeps several times the RAM ring; /data?res=log streams all of it
+#define RAW_LOG_SEGMENT_COUNT 12     // 11 full segments, ~22 days at 10 minutes
+
+// Retention tiers: raw points are rolled up into hourly and daily min/max/mean
+#define HOURLY_POINTS 336    // 14 days
+#define DAILY_POINTS 366     // 1 year
+#define HOURLY_SEGMENT_DIR "/log/hour"
+#define DAILY_SEGMENT_DIR "/log/day"
+
+typedef HistoryStore<MAX_DATA_POINTS, MAX_TIME_ANCHORS, HOURLY_POINTS, DAILY_POINTS> BatteryHistory;
+
+// Small state files written behind by the persistence task
+#define PERSIST_SOC 0x01
+#define PERSIST_SETTINGS 0x02
+#define PERSIST_EPOCH 0x04    // Wall-clock epoch into the log segment headers
+
+// Which dirty state files are due for writing. Any task marks, one writer
+// takes: settings and the epoch go at the next flush, the SOC at most once
+// per PERSIST_SOC_INTERVAL_MS unless a mark was urgent.
+class PersistSchedule {
+private:
+  std::atomic<uint32_t> dirty;   // PERSIST_* files with unsaved changes
+  std::atomic<bool> urgent;      // Write them at the next flush
+  uint32_t lastSocWrite;         // millis, writer only
+
+public:
+  PersistSchedule() : dirty(0), urgent(false), lastSocWrite(0) {}
+
+  void mark(uint32_t items, bool now) {
+    dirty.fetch_or(items);
+    if (now) urgent.store(true);
+  }
+
+  // Clear and return the dirty files that are due now (all of them if
+  // `all`); the caller writes them
+  uint32_t take(uint32_t nowMs, bool all) {
+    bool now = urgent.exchange(false);
+    uint32_t due = PERSIST_SETTINGS | PERSIST_EPOCH;
+    if (all || now || nowMs - lastSocWrite >= PERSIST_SOC_INTERVAL_MS) {
+      due |= PERSIST_SOC;
+    }
+    uint32_t items = dirty.fetch_and(~due) & due;
+    if (items & PERSIST_SOC) lastSocWrite = nowMs;
+    return items;
+  }
+
+  uint32_t pending() const { return dirty.load(); }
+};
+
+// What the analytics step hands back to its owner
+class AnalyticsSink {
+public:
+  virtual ~AnalyticsSink() {}
+  // Around copies of the SOC state, for readers and writers on other tasks.
+  // Held only for the copy, never across SocTracker::update().
+  virtual void lockSoc() {}
+  virtual void unlockSoc() {}
+  // After every SOC update; `becameFull` if the battery was just detected as full
+  virtual void socUpdated(const Sample&, bool) {}
+  // The SOC should be saved, at once if `urgent`
+  virtual void saveSoc(bool urgent) = 0;
+  // A point went into the history
+  virtual void logged(const DataPoint&) {}
+};
+
+// Single task: everything here belongs to whoever calls step()
+class Analytics {
+private:
+  Clock& clock;
+  TimeBase& timeBase;
+  SocTracker& soc;
+  BatteryHistory& history;
+  AnalyticsSink& sink;
+
+  CoulombCounter counter;      // Fed with every sample from the ring
+  uint32_t cursor;             // Next sample it will integrate
+  volatile uint32_t dropped;   // Lapped by the sampling task before being read
+
+  uint32_t lastSocCalcTime;
+  uint32_t lastLogTime;
+  uint32_t lastSocSaveTime;
+  float lastSavedSoc;
+
+public:
+  Analytics(Clock& source, TimeBase& base, SocTracker& tracker, BatteryHistory& store, AnalyticsSink& output)
+    : clock(source), timeBase(base), soc(tracker), history(store), sink(output),
+      cursor(0), dropped(0), lastSocCalcTime(0), lastLogTime(0), lastSocSaveTime(0), lastSavedSoc(0) {}
+
+  // Start the schedule now: the first SOC update after SOC_CALC_INTERVAL_MS,
+  // the first point at the next step. The SOC state must be loaded first.
+  void begin(uint32_t logIntervalMs) {
+    uint32_t now = clock.millis();
+    soc.setBaseline(counter.totals());
+    lastSocCalcTime = now;
+    lastSocSaveTime = now;
+    lastSavedSoc = soc.getSoc();
+    lastLogTime = now - logIntervalMs;
+  }
+
+  // One tick: integrate the new samples, then update the SOC and log a
+  // point when they are due
+  template <size_t N>
+  void step(SampleRing<N>& ring, uint32_t logIntervalMs) {
+    integrate(ring);
+
+    Sample latest = {0, 0.0, 0.0};
+    ring.latest(latest);
+    uint32_t now = clock.millis();
+    if (now - lastSocCalcTime >= SOC_CALC_INTERVAL_MS) {
+      updateSoc(latest);
+    }
+    if (now - lastLogTime >= logIntervalMs) {
+      logData(latest, logIntervalMs);
+      lastLogTime = now;
+    }
+  }
+
+  // Feed the coulomb counter every sample published since the last call.
+  // Samples are lost (and counted in droppedSamples()) if more than the
+  // ring holds arrive between calls; the firmware sizes its ring for
+  // several ticks at the fastest acquisition profile.
+  template <size_t N>
+  void integrate(SampleRing<N>& ring) {
+    Sample batch[INTEGRATE_BATCH];
+    uint32_t lost = 0;
+    size_t count;
+    do {
+      count = ring.readSince(cursor, batch, INTEGRATE_BATCH, &lost);
+      for (size_t i = 0; i < count; i++) {
+        counter.addSample(batch[i].timestampUs, batch[i].current);
+      }
+    } while (count > 0);
+    if (lost > 0) dropped += lost;
+  }
+
+  // Apply the charge integrated since the last update, detect full, and
+  // mark the SOC for saving when it changed enough or has not been saved
+  // for SOC_SAVE_INTERVAL_MS. The update (Peukert pow() and all) runs on a
+  // copy outside the lock; if another task changed the SOC meanwhile
+  // (setFull(), a new capacity) the copy is dropped and the next tick
+  // applies the charge on top of the change.
+  void updateSoc(const Sample& latest) {
+    uint32_t now = clock.millis();
+    CoulombTotals totals = counter.totals();
+    uint32_t logMinutes = timeBase.now();
+    sink.lockSoc();
+    SocTracker next = soc;
+    sink.unlockSoc();
+    uint32_t seen = next.getRevision();
+    bool becameFull = next.update(totals, latest.voltage, latest.current, now, logMinutes);
+    sink.lockSoc();
+    bool current = soc.getRevision() == seen;
+    if (current) soc = next;
+    sink.unlockSoc();
+    if (!current) return;
+    lastSocCalcTime = now;
+
+    sink.socUpdated(latest, becameFull);
+    if (becameFull) {
+      sink.saveSoc(true);
+    }
+
+    float percent = soc.getSoc();
+    if (fabs(percent - lastSavedSoc) > SOC_SAVE_CHANGE || now - lastSocSaveTime >= SOC_SAVE_INTERVAL_MS) {
+      sink.saveSoc(false);
+      lastSocSaveTime = now;
+      lastSavedSoc = percent;
+    }
+  }
+
+  // One point into the history (and through its sink to flash)
+  void logData(const Sample& latest, uint32_t logIntervalMs) {
+    DataPoint point;
+    point.timestamp = timeBase.now();
+    point.voltage = latest.voltage;
+    point.current = latest.current;
+    point.soc = soc.getSoc();
+    history.log(point, logIntervalMs / 60000);
+    sink.logged(point);
+  }
+
+  CoulombTotals totals() const { return counter.totals(); }
+  uint32_t droppedSamples() const { return dropped; }
+};
+
+#endif
@@ -5,6 +5,11 @@
 #define CHARLIEPLEX_DISPLAY_H
 
 #include <Arduino.h>
+#include <soc/gpio_struct.h>
+#include <driver/timer.h>
+#include <hal/cpu_hal.h>
+#include <atomic>
+#include "Hal.h"
 
 // ============================================================================
 // GHOSTING REDUCTION TUNING GUIDE
@@ -12,6 +17,13 @@
 // DISPLAY_BRIGHTNESS (50-500μs)
 //   - Lower = dimmer & less ghosting
 //   - Higher = brighter & more ghosting
+//   - This is the on-time at full brightness; setBrightness() scales it
+//
+// Every segment position gets a fixed slot (SEGMENT_SLOT_US) and every
+// digit a fixed slot (DIGIT_SLOT_US) whether or not its segments are lit, so
+// the frame rate and each segment's duty cycle don't depend on what is
+// displayed ("1" is as bright as "8."). Dimming shortens the on-time and
+// lengthens the blank time by the same amount, so the frame rate stays put.
 //
 // INTER_SEGMENT_DELAY (0-50μs)
 //   - Adds delay between segments on same digit
@@ -28,6 +40,19 @@
 // REVERSE_SCAN (true/false)
 //   - false: Scans D1→D2→D3→D4→D5→D6
 //   - true:  Scans D6→D5→D4→D3→D2→D1 (reversed)
+//
+// DISPLAY_USE_TIMER (true/false, true needs DISPLAY_FAST_GPIO)
+//   - true:  Multiplexed from a hardware timer interrupt, one step per tick.
+//            The interrupt and everything it calls live in IRAM, so the
+//            scan keeps running while LittleFS writes to flash (the cache
+//            is off then and any code in flash would stall or crash it).
+//   - false: The display task calls refresh() (blocking, one digit per call)
+//   The scan stays on the CPU: charlieplexing switches pins between driven
+//   and high-Z, and the I2S/RMT peripherals can only drive levels.
+//
+// DISPLAY_FAST_GPIO (true/false)
+//   - true:  Segments switched with direct GPIO register writes
+//   - false: Segments switched with pinMode()/digitalWrite()
 // ============================================================================
 
 // Display brightness control (microseconds per segment)
@@ -38,6 +63,28 @@
 #define INTER_DIGIT_DELAY 30       // μs delay between digits (0-100)
 #define DISCHARGE_PULSE 0          // μs to actively discharge pins between digits (0-20)
 #define REVERSE_SCAN true          // true = scan D6→D1 instead of D1→D6
+#define SEGMENT_GAP 15             // μs all pins high-Z before each segment
+
+// Fixed scan timing (see above)
+#define SEGMENT_SLOT_US (DISPLAY_BRIGHTNESS + SEGMENT_GAP + INTER_SEGMENT_DELAY)
+#define DIGIT_SLOT_US (8 * SEGMENT_SLOT_US + DISCHARGE_PULSE + INTER_DIGIT_DELAY)
+#define FRAME_US (6 * DIGIT_SLOT_US)
+
+// Hardware timer multiplexing
+#define DISPLAY_USE_TIMER true
+#define DISPLAY_TIMER_NUM 0        // ESP32 hardware timer 0-3
+#define DISPLAY_TIMER_GROUP ((timer_group_t)(DISPLAY_TIMER_NUM / 2))
+#define DISPLAY_TIMER_INDEX ((timer_idx_t)(DISPLAY_TIMER_NUM % 2))
+#define DISPLAY_TIMER_DIVIDER 80   // 80 MHz APB / 80 = 1 μs per timer count
+#define DISPLAY_MIN_TICK_US 2      // Shortest interval the timer is asked for
+
+// Pin switching
+#define DISPLAY_FAST_GPIO true
+#define DISPLAY_BENCHMARK_ROUNDS 32  // Segments timed per path by benchmark()
+
+#if DISPLAY_USE_TIMER && !DISPLAY_FAST_GPIO
+#error "DISPLAY_USE_TIMER needs DISPLAY_FAST_GPIO (pinMode()/digitalWrite() are not in IRAM)"
+#endif
 
 // Flash interval for charging indicator (milliseconds)
 #define FLASH_INTERVAL_MS 400
@@ -90,52 +137,242 @@ const uint8_t digitPatterns[13] = {
   0b00000000   // 12 = blank
 };
 
+// Pin state that lights one segment, precomputed from digitMap
+struct SegmentFrame {
+  uint8_t anode;          // charliePins index driven HIGH
+  uint8_t cathode;        // charliePins index driven LOW
+  uint32_t enableLow;     // GPIO 0-31 output enable bits
+  uint32_t outLow;        // GPIO 0-31 bits driven HIGH
+  uint32_t enableHigh;    // GPIO 32-39 output enable bits (bit 0 = GPIO32)
+  uint32_t outHigh;       // GPIO 32-39 bits driven HIGH
+};
+
+// Everything the scanner reads. Writers change the digit buffer and then
+// commit(), which builds the back frame and publishes it with one atomic
+// store; the scanner only switches frames between full scans, so it never
+// shows a half-updated display or digits from two different commits.
+struct DisplayFrame {
+  SegmentFrame segments[6][8];  // Lit segments of each digit
+  uint8_t segmentCount[6];      // 0 when dimmed to 0%
+  uint32_t onTimeUs;            // Per-segment on-time at the committed brightness
+};
+
+// Cycle counts (ESP.getCycleCount) for /debug/display
+struct DisplayStats {
+  uint32_t arduinoSegmentCycles;   // Light + blank one segment via pinMode()/digitalWrite()
+  uint32_t registerSegmentCycles;  // Light + blank one segment via GPIO registers
+  uint32_t ticks;                  // Timer interrupts handled
+  uint64_t tickCycles;             // Cycles spent in tick()
+  uint32_t maxTickCycles;
+};
+
 class CharlieplexDisplay {
 private:
   uint8_t displayBuffer[6];     // What to show on each digit (0-9, 10=minus, 11=underscore, 12=blank)
   bool decimalPoints[6];        // Decimal point for each digit
   uint8_t currentDigit;
   uint8_t toggleState;          // For flashing DP when charging
+  Clock& clock;                 // Times the SOC cycle and the charging flash
   unsigned long lastFlashTime;
   unsigned long lastSocDisplayTime;  // Track when to show SOC
   bool showingSoc;              // Currently showing SOC instead of voltage
   float cachedVoltage;          // Store voltage when showing SOC
   float cachedSoc;              // Store SOC to display
   
-  void setAllPinsHighZ() {
+  // Front/back frames, see DisplayFrame
+  DisplayFrame frameBuffers[2];
+  std::atomic<uint8_t> publishedFrame;  // Newest committed frame
+  std::atomic<uint8_t> scanningFrame;   // Frame the scanner is using
+  const DisplayFrame* scan;             // = &frameBuffers[scanningFrame]
+  
+  uint32_t pinMaskLow;          // All charlie pins in GPIO 0-31
+  uint32_t pinMaskHigh;         // All charlie pins in GPIO 32-39
+  DisplayStats stats;
+  std::atomic<uint8_t> brightness;  // Percent of DISPLAY_BRIGHTNESS on-time
+  
+  // Timer-driven scan state (only touched by tick())
+  enum ScanPhase {
+    PHASE_GAP,         // All pins high-Z before the next segment
+    PHASE_SEGMENT,     // One segment lit
+    PHASE_DISCHARGE,   // All pins driven low between digits
+    PHASE_DIGIT_GAP    // Blank time between digits
+  };
+  ScanPhase scanPhase;
+  uint8_t scanSegment;          // Next frame of the current digit
+  
+  // Timer alarm callback, registered as an IRAM interrupt. Reloads the
+  // alarm with the time the scan step asked for.
+  static bool IRAM_ATTR onTimer(void* arg) {
+    CharlieplexDisplay* display = (CharlieplexDisplay*)arg;
+    uint32_t start = cpu_hal_get_cycle_count();
+    uint32_t next = display->tick();
+    uint32_t cycles = cpu_hal_get_cycle_count() - start;
+    display->stats.ticks++;
+    display->stats.tickCycles += cycles;
+    if (cycles > display->stats.maxTickCycles) display->stats.maxTickCycles = cycles;
+    timer_group_set_alarm_value_in_isr(DISPLAY_TIMER_GROUP, DISPLAY_TIMER_INDEX,
+                                       next < DISPLAY_MIN_TICK_US ? DISPLAY_MIN_TICK_US : next);
+    return false;  // No task woken
+  }
+  
+  uint8_t IRAM_ATTR scanDigit() const {
+    return REVERSE_SCAN ? 5 - currentDigit : currentDigit;
+  }
+  
+  bool segmentLit(uint8_t digit, uint8_t seg) const {
+    if (seg == 7) return decimalPoints[digit];
+    return (digitPatterns[displayBuffer[digit]] & (1 << seg)) != 0;
+  }
+  
+  // Blank time after the last lit segment of a digit: the unused segment
+  // slots plus the inter-digit delay, so every digit takes DIGIT_SLOT_US
+  static uint32_t IRAM_ATTR digitGapUs(const DisplayFrame& frame, uint8_t digit) {
+    return INTER_DIGIT_DELAY + (8 - frame.segmentCount[digit]) * SEGMENT_SLOT_US;
+  }
+  
+  // Switch the scanner to the newest committed frame
+  void IRAM_ATTR latchFrame() {
+    uint8_t index = publishedFrame.load(std::memory_order_acquire);
+    scanningFrame.store(index, std::memory_order_release);
+    scan = &frameBuffers[index];
+  }
+  
+  static void addPin(uint8_t pin, uint32_t& low, uint32_t& high) {
+    if (pin < 32) {
+      low |= 1UL << pin;
+    } else {
+      high |= 1UL << (pin - 32);
+    }
+  }
+  
+  // Precompute the frame of every lit segment so the scan only has to
+  // copy bitmasks into the GPIO registers
+  void buildFrame(DisplayFrame& frame) {
+    frame.onTimeUs = (uint32_t)DISPLAY_BRIGHTNESS * brightness.load(std::memory_order_relaxed) / 100;
+    for (uint8_t digit = 0; digit < 6; digit++) {
+      uint8_t count = 0;
+      for (uint8_t seg = 0; frame.onTimeUs > 0 && seg < 8; seg++) {
+        if (!segmentLit(digit, seg)) continue;
+        uint8_t anode = digitMap[digit][seg][0];
+        uint8_t cathode = digitMap[digit][seg][1];
+        if (anode == 255 || cathode == 255) continue;  // Invalid mapping
+        
+        SegmentFrame& segment = frame.segments[digit][count++];
+        segment.anode = anode;
+        segment.cathode = cathode;
+        segment.enableLow = segment.outLow = segment.enableHigh = segment.outHigh = 0;
+        addPin(charliePins[anode], segment.enableLow, segment.enableHigh);
+        addPin(charliePins[cathode], segment.enableLow, segment.enableHigh);
+        addPin(charliePins[anode], segment.outLow, segment.outHigh);
+      }
+      frame.segmentCount[digit] = count;
+    }
+  }
+  
+  void setAllPinsHighZArduino() {
     // Set all pins to true high impedance (no pull-ups/downs)
     for (int i = 0; i < 9; i++) {
       pinMode(charliePins[i], INPUT);
     }
   }
   
-  void dischargeAllPins() {
-    // Actively discharge all pins to GND briefly
-    if (DISCHARGE_PULSE > 0) {
+  void lightFrameArduino(const SegmentFrame& frame) {
+    // First turn everything off to prevent crosstalk
+    setAllPinsHighZArduino();
+    
+    // Now set only the two pins we need
+    pinMode(charliePins[frame.anode], OUTPUT);
+    pinMode(charliePins[frame.cathode], OUTPUT);
+    digitalWrite(charliePins[frame.anode], HIGH);
+    digitalWrite(charliePins[frame.cathode], LOW);
+  }
+  
+  // Pins are left configured as plain GPIO inputs by begin(), so switching
+  // the output driver on and off is all high-Z <-> driven takes
+  void IRAM_ATTR setAllPinsHighZRegister() {
+    GPIO.enable_w1tc = pinMaskLow;
+    GPIO.enable1_w1tc.val = pinMaskHigh;
+  }
+  
+  void IRAM_ATTR lightFrameRegister(const SegmentFrame& frame) {
+    setAllPinsHighZRegister();
+    GPIO.out_w1tc = frame.enableLow & ~frame.outLow;
+    GPIO.out_w1ts = frame.outLow;
+    GPIO.out1_w1tc.val = frame.enableHigh & ~frame.outHigh;
+    GPIO.out1_w1ts.val = frame.outHigh;
+    GPIO.enable_w1ts = frame.enableLow;
+    GPIO.enable1_w1ts.val = frame.enableHigh;
+  }
+  
+  void IRAM_ATTR setAllPinsHighZ() {
+    if (DISPLAY_FAST_GPIO) {
+      setAllPinsHighZRegister();
+    } else {
+      setAllPinsHighZArduino();
+    }
+  }
+  
+  void IRAM_ATTR lightFrame(const SegmentFrame& frame) {
+    if (DISPLAY_FAST_GPIO) {
+      lightFrameRegister(frame);
+    } else {
+      lightFrameArduino(frame);
+    }
+  }
+  
+  // Drive every pin LOW to discharge any capacitive buildup
+  void IRAM_ATTR driveAllPinsLow() {
+    if (DISPLAY_FAST_GPIO) {
+      GPIO.out_w1tc = pinMaskLow;
+      GPIO.out1_w1tc.val = pinMaskHigh;
+      GPIO.enable_w1ts = pinMaskLow;
+      GPIO.enable1_w1ts.val = pinMaskHigh;
+    } else {
       for (int i = 0; i < 9; i++) {
         pinMode(charliePins[i], OUTPUT);
         digitalWrite(charliePins[i], LOW);
       }
+    }
+  }
+  
+  void dischargeAllPins() {
+    // Actively discharge all pins to GND briefly
+    if (DISCHARGE_PULSE > 0) {
+      driveAllPinsLow();
       delayMicroseconds(DISCHARGE_PULSE);
       setAllPinsHighZ();
     }
   }
   
-  void lightSegment(uint8_t anode, uint8_t cathode) {
-    if (anode == 255 || cathode == 255) return;  // Invalid mapping
+  // Time lighting and blanking one segment through both pin paths
+  void benchmark() {
+    SegmentFrame frame;
+    bool found = false;
+    for (uint8_t digit = 0; digit < 6 && !found; digit++) {
+      if (scan->segmentCount[digit] > 0) {
+        frame = scan->segments[digit][0];
+        found = true;
+      }
+    }
+    if (!found) return;
     
-    // First turn everything off to prevent crosstalk
-    setAllPinsHighZ();
+    uint32_t start = ESP.getCycleCount();
+    for (int i = 0; i < DISPLAY_BENCHMARK_ROUNDS; i++) {
+      lightFrameArduino(frame);
+      setAllPinsHighZArduino();
+    }
+    stats.arduinoSegmentCycles = (ESP.getCycleCount() - start) / DISPLAY_BENCHMARK_ROUNDS;
     
-    // Now set only the two pins we need
-    pinMode(charliePins[anode], OUTPUT);
-    pinMode(charliePins[cathode], OUTPUT);
-    digitalWrite(charliePins[anode], HIGH);
-    digitalWrite(charliePins[cathode], LOW);
+    start = ESP.getCycleCount();
+    for (int i = 0; i < DISPLAY_BENCHMARK_ROUNDS; i++) {
+      lightFrameRegister(frame);
+      setAllPinsHighZRegister();
+    }
+    stats.registerSegmentCycles = (ESP.getCycleCount() - start) / DISPLAY_BENCHMARK_ROUNDS;
   }
   
 public:
-  CharlieplexDisplay() {
+  explicit CharlieplexDisplay(Clock& timeSource) : clock(timeSource) {
     currentDigit = 0;
     toggleState = 0;
     lastFlashTime = 0;
@@ -143,14 +380,70 @@ public:
     showingSoc = false;
     cachedVoltage = 0;
     cachedSoc = 0;
+    scanPhase = PHASE_GAP;
+    scanSegment = 0;
+    stats = {0, 0, 0, 0, 0};
+    brightness.store(100);
+    pinMaskLow = 0;
+    pinMaskHigh = 0;
+    for (int i = 0; i < 9; i++) {
+      addPin(charliePins[i], pinMaskLow, pinMaskHigh);
+    }
     for (int i = 0; i < 6; i++) {
       displayBuffer[i] = 0;
       decimalPoints[i] = false;
     }
+    buildFrame(frameBuffers[0]);
+    publishedFrame.store(0);
+    latchFrame();
   }
   
   void begin() {
+    // pinMode() routes the pins to the GPIO matrix; after this the register
+    // path only toggles output enables and levels
+    setAllPinsHighZArduino();
+    benchmark();
     setAllPinsHighZ();
+    
+    if (DISPLAY_USE_TIMER) {
+      // The IDF driver rather than timerAttachInterrupt(), which does not
+      // allocate an IRAM interrupt
+      timer_config_t config = {};
+      config.divider = DISPLAY_TIMER_DIVIDER;
+      config.counter_dir = TIMER_COUNT_UP;
+      config.counter_en = TIMER_PAUSE;
+      config.alarm_en = TIMER_ALARM_EN;
+      config.auto_reload = TIMER_AUTORELOAD_EN;
+      timer_init(DISPLAY_TIMER_GROUP, DISPLAY_TIMER_INDEX, &config);
+      timer_set_counter_value(DISPLAY_TIMER_GROUP, DISPLAY_TIMER_INDEX, 0);
+      timer_set_alarm_value(DISPLAY_TIMER_GROUP, DISPLAY_TIMER_INDEX, SEGMENT_GAP);
+      timer_enable_intr(DISPLAY_TIMER_GROUP, DISPLAY_TIMER_INDEX);
+      timer_isr_callback_add(DISPLAY_TIMER_GROUP, DISPLAY_TIMER_INDEX, &CharlieplexDisplay::onTimer,
+                             this, ESP_INTR_FLAG_IRAM);
+      timer_start(DISPLAY_TIMER_GROUP, DISPLAY_TIMER_INDEX);
+    }
+  }
+  
+  // Global dimming, 0-100% of full on-time, applied by the next commit().
+  // The frame rate is unchanged. Safe to call from any task.
+  void setBrightness(uint8_t percent) {
+    if (percent > 100) percent = 100;
+    brightness.store(percent, std::memory_order_relaxed);
+  }
+  
+  uint8_t getBrightness() const { return brightness.load(std::memory_order_relaxed); }
+  
+  // Publish the digit buffer (and brightness) to the scanner. Call from one
+  // task only, after the set*() calls for an update. Returns false without
+  // changing anything if the scanner has not switched to the previous
+  // commit yet (it does so at the start of the next scan, within one
+  // FRAME_US); just commit again later.
+  bool commit() {
+    uint8_t back = 1 - publishedFrame.load(std::memory_order_relaxed);
+    if (scanningFrame.load(std::memory_order_acquire) == back) return false;
+    buildFrame(frameBuffers[back]);
+    publishedFrame.store(back, std::memory_order_release);
+    return true;
   }
   
   void setDigit(uint8_t digit, uint8_t value, bool dp = false) {
@@ -200,7 +493,7 @@ public:
     cachedVoltage = voltage;
     cachedSoc = soc;
     
-    unsigned long currentTime = millis();
+    unsigned long currentTime = clock.millis();
     unsigned long elapsedInCycle = currentTime - lastSocDisplayTime;
     
     // Show SOC for 1 second every 10 seconds (1000ms out of 10000ms)
@@ -226,7 +519,7 @@ public:
     bool charging = (current > 0);
     float absCurrent = abs(current);
 
-    unsigned long currentTime = millis();
+    unsigned long currentTime = clock.millis();
     
     // Toggle flash state every FLASH_INTERVAL_MS
     if (currentTime - lastFlashTime >= FLASH_INTERVAL_MS) {
@@ -253,6 +546,9 @@ public:
   }
   
   void refresh() {
+    // New commits are only picked up at the start of a scan
+    if (currentDigit == 0) latchFrame();
+    
     // Determine which digit to display (support reverse scanning)
     uint8_t displayDigit;
     if (REVERSE_SCAN) {
@@ -261,38 +557,17 @@ public:
       displayDigit = currentDigit;      // Scan D1→D6
     }
     
-    // Get pattern for current digit
-    uint8_t pattern = digitPatterns[displayBuffer[displayDigit]];
-    
     // Light each segment that should be on
-    for (int seg = 0; seg < 8; seg++) {
-      bool shouldLight = false;
+    for (int i = 0; i < scan->segmentCount[displayDigit]; i++) {
+      // Extra discharge between segments to prevent ghosting on shared pins
+      setAllPinsHighZ();
+      delayMicroseconds(SEGMENT_SLOT_US - scan->onTimeUs);
       
-      if (seg == 7) {  // Decimal point
-        shouldLight = decimalPoints[displayDigit];
-      } else {  // Regular segment
-        shouldLight = (pattern & (1 << seg)) != 0;
-      }
+      lightFrame(scan->segments[displayDigit][i]);
+      delayMicroseconds(scan->onTimeUs);
       
-      if (shouldLight) {
-        uint8_t anode = digitMap[displayDigit][seg][0];
-        uint8_t cathode = digitMap[displayDigit][seg][1];
-        
-        // Extra discharge between segments to prevent ghosting on shared pins
-        setAllPinsHighZ();
-        delayMicroseconds(15);
-        
-        lightSegment(anode, cathode);
-        delayMicroseconds(DISPLAY_BRIGHTNESS);
-        
-        // Turn off immediately
-        setAllPinsHighZ();
-        
-        // Optional inter-segment delay
-        if (INTER_SEGMENT_DELAY > 0) {
-          delayMicroseconds(INTER_SEGMENT_DELAY);
-        }
-      }
+      // Turn off immediately
+      setAllPinsHighZ();
     }
     
     // Turn off all pins before moving to next digit
@@ -301,14 +576,62 @@ public:
     // Optional discharge pulse
     dischargeAllPins();
     
-    // Optional inter-digit delay
-    if (INTER_DIGIT_DELAY > 0) {
-      delayMicroseconds(INTER_DIGIT_DELAY);
-    }
+    // Inter-digit delay, padded for the unlit segments
+    delayMicroseconds(digitGapUs(*scan, displayDigit));
     
     // Move to next digit
     currentDigit = (currentDigit + 1) % 6;
   }
+  
+  // One step of the timer-driven scan, the non-blocking equivalent of
+  // refresh(): each call does the pin changes for one phase and returns how
+  // long (μs) to wait before the next call, instead of delaying.
+  // An if chain rather than a switch, which may compile to a jump table in
+  // flash.
+  uint32_t IRAM_ATTR tick() {
+    if (scanPhase == PHASE_SEGMENT) {
+      // Segment has been on long enough
+      setAllPinsHighZ();
+      scanPhase = PHASE_GAP;
+      return SEGMENT_SLOT_US - scan->onTimeUs;
+    }
+    
+    if (scanPhase == PHASE_GAP) {
+      // Light the next segment of this digit, if any
+      uint8_t digit = scanDigit();
+      if (scanSegment < scan->segmentCount[digit]) {
+        lightFrame(scan->segments[digit][scanSegment]);
+        scanSegment++;
+        scanPhase = PHASE_SEGMENT;
+        return scan->onTimeUs;
+      }
+      
+      // Digit finished
+      if (DISCHARGE_PULSE > 0) {
+        driveAllPinsLow();
+        scanPhase = PHASE_DISCHARGE;
+        return DISCHARGE_PULSE;
+      }
+      scanPhase = PHASE_DIGIT_GAP;
+      return digitGapUs(*scan, digit);
+    }
+    
+    if (scanPhase == PHASE_DISCHARGE) {
+      setAllPinsHighZ();
+      scanPhase = PHASE_DIGIT_GAP;
+      return digitGapUs(*scan, scanDigit());
+    }
+    
+    // PHASE_DIGIT_GAP: move to next digit, picking up any new commit at
+    // the start of a scan
+    currentDigit = (currentDigit + 1) % 6;
+    scanSegment = 0;
+    scanPhase = PHASE_GAP;
+    if (currentDigit == 0) latchFrame();
+    return 0;
+  }
+  
+  const DisplayStats& getStats() const { return stats; }
 };
 
 #endif
\ No newline at end of file
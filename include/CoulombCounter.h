@@ -0,0 +1,106 @@
+// Integrating coulomb counter
+// Accumulates every INA226 sample using trapezoidal integration on the
+// sample timestamps. Charge is kept in 64-bit fixed point (milliamp-
+// microseconds) so nothing is lost to float rounding over months of uptime.
+
+#ifndef COULOMB_COUNTER_H
+#define COULOMB_COUNTER_H
+
+#include <stdint.h>
+
+// 1 Ah = 1000 mA * 3600 s * 1e6 us
+#define MA_US_PER_AH 3600000000000LL
+
+// Running totals since the counter was reset
+struct CoulombTotals {
+  int64_t chargedMaUs;       // Charge into the battery (mA*us, >= 0)
+  int64_t dischargedMaUs;    // Charge out of the battery (mA*us, >= 0)
+  int64_t dischargeTimeUs;   // Time spent discharging (us)
+  int64_t elapsedUs;         // Total integrated time (us)
+  uint32_t sampleCount;
+};
+
+class CoulombCounter {
+private:
+  // Areas are accumulated doubled ((i0 + i1) * dt) so the trapezoid rule
+  // stays exact in integer arithmetic; halved when read out.
+  int64_t charged2;
+  int64_t discharged2;
+  int64_t dischargeTimeUs;
+  int64_t elapsedUs;
+  uint32_t sampleCount;
+  bool hasLast;
+  uint32_t lastTimestampUs;
+  int32_t lastCurrentMa;
+
+  // Add the doubled area of one trapezoid segment where the current does
+  // not change sign
+  void addSegment(int32_t i0, int32_t i1, int64_t dtUs) {
+    int64_t area2 = (int64_t)(i0 + i1) * dtUs;
+    if (area2 > 0) {
+      charged2 += area2;
+    } else if (area2 < 0) {
+      discharged2 -= area2;
+      dischargeTimeUs += dtUs;
+    }
+  }
+
+public:
+  CoulombCounter() {
+    reset();
+  }
+
+  void reset() {
+    charged2 = 0;
+    discharged2 = 0;
+    dischargeTimeUs = 0;
+    elapsedUs = 0;
+    sampleCount = 0;
+    hasLast = false;
+    lastTimestampUs = 0;
+    lastCurrentMa = 0;
+  }
+
+  // Integrate one sample. Timestamps are micros() values and may wrap.
+  void addSample(uint32_t timestampUs, float currentA) {
+    int32_t currentMa = (int32_t)(currentA * 1000.0f + (currentA >= 0 ? 0.5f : -0.5f));
+    sampleCount++;
+
+    if (!hasLast) {
+      hasLast = true;
+      lastTimestampUs = timestampUs;
+      lastCurrentMa = currentMa;
+      return;
+    }
+
+    int64_t dtUs = (uint32_t)(timestampUs - lastTimestampUs);
+    int32_t i0 = lastCurrentMa;
+    int32_t i1 = currentMa;
+
+    if ((i0 < 0 && i1 > 0) || (i0 > 0 && i1 < 0)) {
+      // Current crosses zero inside the interval: split at the crossing
+      // so charge and discharge are accounted separately
+      int64_t tZero = dtUs * (i0 < 0 ? -i0 : i0) / ((i0 < 0 ? -i0 : i0) + (i1 < 0 ? -i1 : i1));
+      addSegment(i0, 0, tZero);
+      addSegment(0, i1, dtUs - tZero);
+    } else {
+      addSegment(i0, i1, dtUs);
+    }
+
+    elapsedUs += dtUs;
+    lastTimestampUs = timestampUs;
+    lastCurrentMa = currentMa;
+  }
+
+  CoulombTotals totals() const {
+    CoulombTotals t;
+    t.chargedMaUs = charged2 / 2;
+    t.dischargedMaUs = discharged2 / 2;
+    t.dischargeTimeUs = dischargeTimeUs;
+    t.elapsedUs = elapsedUs;
+    t.sampleCount = sampleCount;
+    return t;
+  }
+};
+
+#endif
@@ -0,0 +1,106 @@
+// Delta coding for packed log points
+// Voltage, current and SOC change slowly between log points, so a point is
+// stored as its difference from the previous one: each field's delta is
+// zigzag encoded (small negative numbers stay small) and written as an
+// LEB128 varint. A steady reading costs 3 bytes instead of 5. Timestamps
+// are implicit (PackedPoint.h) and cost nothing.
+
+#ifndef DELTA_CODEC_H
+#define DELTA_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "PackedPoint.h"
+
+#define DELTA_POINT_MAX_BYTES 8  // 3 + 3 + 2 varint bytes
+
+inline uint32_t zigzagEncode(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t zigzagDecode(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+inline size_t putVarint(uint8_t* out, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+// Bytes used, 0 if `len` ends inside the varint
+inline size_t getVarint(const uint8_t* in, size_t len, uint32_t& value) {
+  value = 0;
+  for (size_t n = 0; n < len && n < 5; n++) {
+    value |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+    if (!(in[n] & 0x80)) return n + 1;
+  }
+  return 0;
+}
+
+// Deltas are taken modulo the field width, so any step (even a full-scale
+// jump) round-trips exactly. A fresh coder codes against an all-zero point,
+// which makes the first point of a segment a key point.
+class PointDeltaEncoder {
+private:
+  PackedPoint previous;
+
+public:
+  PointDeltaEncoder() { reset(); }
+
+  void reset() {
+    previous.voltage = 0;
+    previous.current = 0;
+    previous.soc = 0;
+  }
+
+  // Continue after an already coded point
+  void setPrevious(const PackedPoint& point) { previous = point; }
+
+  // Code `point` into `out` (DELTA_POINT_MAX_BYTES), returns the length
+  size_t encode(const PackedPoint& point, uint8_t* out) {
+    size_t n = 0;
+    n += putVarint(out + n, zigzagEncode((int16_t)(uint16_t)(point.voltage - previous.voltage)));
+    n += putVarint(out + n, zigzagEncode((int16_t)(uint16_t)(point.current - previous.current)));
+    n += putVarint(out + n, zigzagEncode((int8_t)(uint8_t)(point.soc - previous.soc)));
+    previous = point;
+    return n;
+  }
+};
+
+class PointDeltaDecoder {
+private:
+  PackedPoint previous;
+
+public:
+  PointDeltaDecoder() { reset(); }
+
+  void reset() {
+    previous.voltage = 0;
+    previous.current = 0;
+    previous.soc = 0;
+  }
+
+  // Decode one point, returns the bytes used or 0 if `len` ends inside it
+  size_t decode(const uint8_t* in, size_t len, PackedPoint& point) {
+    uint32_t voltage, current, soc;
+    size_t n = 0, used;
+    if ((used = getVarint(in + n, len - n, voltage)) == 0) return 0;
+    n += used;
+    if ((used = getVarint(in + n, len - n, current)) == 0) return 0;
+    n += used;
+    if ((used = getVarint(in + n, len - n, soc)) == 0) return 0;
+    n += used;
+    point.voltage = (uint16_t)(previous.voltage + zigzagDecode(voltage));
+    point.current = (int16_t)(uint16_t)(previous.current + zigzagDecode(current));
+    point.soc = (uint8_t)(previous.soc + zigzagDecode(soc));
+    previous = point;
+    return n;
+  }
+};
+
+#endif
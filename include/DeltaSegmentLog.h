@@ -0,0 +1,402 @@
+// Append-only segmented log of delta-coded points on LittleFS
+// Same segment scheme as SegmentLog (headers, recycling, sequence numbers),
+// but records are PackedPoints delta coded against the previous point of
+// the segment (DeltaCodec.h), so they vary in length. Every segment starts
+// with a key point and decodes on its own; a torn final point is detected
+// by the decoder running out of bytes.
+//
+// The first record of every segment (from its header) is kept in RAM, so a
+// record is found by a binary search over the segments and decoding from
+// the start of one segment, not of the log.
+//
+// Not thread safe: appends and rotations recycle segment files, so the
+// owner serialises them with every read (including Readers) across tasks.
+
+#ifndef DELTA_SEGMENT_LOG_H
+#define DELTA_SEGMENT_LOG_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "SegmentLog.h"
+#include "DeltaCodec.h"
+
+#define DELTA_SEGMENT_VERSION 2     // SegmentHeader.version of delta-coded segments
+#define DELTA_READ_BUFFER 64
+#define DELTA_MAX_SEGMENTS 32       // Segments the first-record index can hold
+
+// Reads one segment file a point at a time through a small buffer
+class DeltaSegmentFile {
+private:
+  File file;
+  uint8_t buffer[DELTA_READ_BUFFER];
+  size_t len;
+  size_t pos;
+  bool ended;
+  PointDeltaDecoder decoder;
+
+  void refill() {
+    memmove(buffer, buffer + pos, len - pos);
+    len -= pos;
+    pos = 0;
+    size_t got = file.read(buffer + len, sizeof(buffer) - len);
+    if (got == 0) ended = true;
+    len += got;
+  }
+
+public:
+  SegmentHeader header;
+
+  DeltaSegmentFile() : len(0), pos(0), ended(true) {}
+
+  // Open and validate a segment, false if it is missing or not delta coded
+  bool open(fs::FS& fs, const String& path) {
+    close();
+    if (!fs.exists(path)) return false;
+    file = fs.open(path, "r");
+    if (!file) return false;
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != SEGMENT_MAGIC || header.version != DELTA_SEGMENT_VERSION ||
+        header.recordSize != sizeof(PackedPoint)) {
+      close();
+      return false;
+    }
+    len = 0;
+    pos = 0;
+    ended = false;
+    decoder.reset();
+    return true;
+  }
+
+  void close() {
+    if (file) file.close();
+    ended = true;
+  }
+
+  // Next point, false at the end of the segment
+  bool next(PackedPoint& point) {
+    if (len - pos < DELTA_POINT_MAX_BYTES && !ended) refill();
+    size_t used = decoder.decode(buffer + pos, len - pos, point);
+    if (used == 0) return false;
+    pos += used;
+    return true;
+  }
+
+  // After next() returned false: bytes of a partial point were left over
+  bool torn() const { return pos != len; }
+};
+
+// Where a segment's records start, from its header
+struct DeltaSegmentIndex {
+  uint32_t sequence;
+  uint32_t firstRecord;
+  bool valid;
+};
+
+class DeltaSegmentLog {
+private:
+  fs::FS& fs;
+  const char* dir;
+  uint16_t recordsPerSegment;
+  uint8_t segmentCount;
+
+  bool hasActive;
+  uint32_t activeSequence;
+  uint32_t activeRecords;     // Records in the active segment
+  uint32_t nextRecord;        // Log-wide index of the next record
+  uint32_t userData;
+  uint32_t codedBytes;        // Record bytes after delta coding
+  PointDeltaEncoder encoder;
+  SegmentLogStats stats;
+  DeltaSegmentIndex segmentIndex[DELTA_MAX_SEGMENTS];  // By slot
+
+  String slotPath(uint8_t slot) const {
+    return String(dir) + "/" + String(slot) + ".seg";
+  }
+
+  String segmentPath(uint32_t sequence) const {
+    return slotPath(sequence % segmentCount);
+  }
+
+  bool readHeader(uint8_t slot, SegmentHeader& header) {
+    DeltaSegmentFile segment;
+    if (!segment.open(fs, slotPath(slot))) return false;
+    header = segment.header;
+    segment.close();
+    return true;
+  }
+
+  uint32_t oldestSequence() const {
+    return activeSequence >= (uint32_t)(segmentCount - 1) ? activeSequence - (segmentCount - 1) : 0;
+  }
+
+  void indexSegment(const SegmentHeader& header) {
+    DeltaSegmentIndex& entry = segmentIndex[header.sequence % segmentCount];
+    entry.sequence = header.sequence;
+    entry.firstRecord = header.firstRecord;
+    entry.valid = true;
+  }
+
+  void clearIndex() {
+    for (uint8_t slot = 0; slot < segmentCount; slot++) {
+      segmentIndex[slot].valid = false;
+    }
+  }
+
+  bool startSegment(uint32_t sequence) {
+    File file = fs.open(segmentPath(sequence), "w");  // Recycles the oldest segment
+    if (!file) {
+      Serial.println("Failed to open log segment for writing");
+      return false;
+    }
+    SegmentHeader header = {SEGMENT_MAGIC, DELTA_SEGMENT_VERSION, sizeof(PackedPoint), sequence, nextRecord, userData};
+    size_t written = file.write((uint8_t*)&header, sizeof(header));
+    file.close();
+    stats.flashBytes += written;
+    if (written != sizeof(header)) {
+      Serial.println("Failed to write log segment header");
+      return false;
+    }
+    if (hasActive) stats.segmentsRotated++;
+    indexSegment(header);
+    hasActive = true;
+    activeSequence = sequence;
+    activeRecords = 0;
+    encoder.reset();  // Key point first, so the segment decodes on its own
+    return true;
+  }
+
+public:
+  // Reads stored points by log-wide index, a buffer at a time (e.g.
+  // straight into an HTTP response). Increasing indexes in the same
+  // segment continue decoding where the last read stopped; anything else
+  // seeks to the start of the segment holding the point. Each read()
+  // checks the index first, so a segment recycled since the last read is
+  // never decoded as old history.
+  class Reader {
+  private:
+    DeltaSegmentLog& log;
+    DeltaSegmentFile file;
+    bool isOpen;
+    uint32_t segment;         // Sequence of the open segment
+    uint32_t index;           // Log-wide index of the next point in it
+
+  public:
+    uint32_t decoded;         // Points decoded so far, wanted or not
+
+    explicit Reader(DeltaSegmentLog& owner)
+      : log(owner), isOpen(false), segment(0), index(0), decoded(0) {}
+
+    // Point with log-wide index `wanted`, false if it is not (or no longer)
+    // stored
+    bool read(uint32_t wanted, PackedPoint& point) {
+      uint32_t target;
+      if (!log.findSegment(wanted, target)) {
+        file.close();  // Its segment may have been recycled
+        isOpen = false;
+        return false;
+      }
+      if (!isOpen || target != segment || (int32_t)(wanted - index) < 0) {
+        file.close();
+        isOpen = file.open(log.fs, log.segmentPath(target)) && file.header.sequence == target;
+        if (!isOpen) return false;
+        segment = target;
+        index = file.header.firstRecord;
+      }
+      while (file.next(point)) {
+        decoded++;
+        if (index++ == wanted) return true;
+      }
+      isOpen = false;  // Torn or short segment; reopen to see any appends
+      return false;
+    }
+  };
+
+  DeltaSegmentLog(fs::FS& filesystem, const char* directory, uint16_t perSegment, uint8_t segments)
+    : fs(filesystem), dir(directory), recordsPerSegment(perSegment), segmentCount(segments) {
+    hasActive = false;
+    activeSequence = 0;
+    activeRecords = 0;
+    nextRecord = 0;
+    userData = 0;
+    codedBytes = 0;
+    stats = {0, 0, 0};
+    if (segmentCount > DELTA_MAX_SEGMENTS) segmentCount = DELTA_MAX_SEGMENTS;
+    clearIndex();
+  }
+
+  // Scan segment headers to find where the log ends and decode the active
+  // segment to continue its delta chain.
+  // Returns true if existing records were found.
+  bool begin() {
+    if (!fs.exists(dir)) {
+      fs.mkdir(dir);
+    }
+
+    bool found = false;
+    SegmentHeader newest;
+    clearIndex();
+    for (uint8_t slot = 0; slot < segmentCount; slot++) {
+      SegmentHeader header;
+      if (!readHeader(slot, header)) continue;
+      if (header.sequence % segmentCount == slot) indexSegment(header);
+      if (!found || (int32_t)(header.sequence - newest.sequence) > 0) {
+        newest = header;
+        found = true;
+      }
+    }
+
+    if (!found) return false;
+
+    hasActive = true;
+    activeSequence = newest.sequence;
+    userData = newest.userData;
+
+    DeltaSegmentFile segment;
+    PackedPoint point;
+    bool torn = true;
+    activeRecords = 0;
+    encoder.reset();
+    if (segment.open(fs, segmentPath(activeSequence))) {
+      while (segment.next(point)) {
+        activeRecords++;
+        encoder.setPrevious(point);
+      }
+      torn = segment.torn();
+      segment.close();
+    }
+    nextRecord = newest.firstRecord + activeRecords;
+
+    // Appending after a torn point would corrupt every later one, so
+    // continue in a fresh segment
+    if (torn || activeRecords >= recordsPerSegment) {
+      startSegment(activeSequence + 1);
+    }
+    return nextRecord > 0;
+  }
+
+  bool append(const PackedPoint& point) {
+    if (!hasActive || activeRecords >= recordsPerSegment) {
+      if (!startSegment(hasActive ? activeSequence + 1 : 0)) return false;
+    }
+
+    File file = fs.open(segmentPath(activeSequence), "a");
+    if (!file) {
+      Serial.println("Failed to open log segment for appending");
+      return false;
+    }
+    // Encode from a copy: a failed write must not advance the chain
+    PointDeltaEncoder next = encoder;
+    uint8_t bytes[DELTA_POINT_MAX_BYTES];
+    size_t length = next.encode(point, bytes);
+    size_t written = file.write(bytes, length);
+    file.close();
+
+    stats.payloadBytes += sizeof(PackedPoint);
+    stats.flashBytes += written;
+    if (written != length) {
+      Serial.println("Failed to append log record");
+      if (written > 0) startSegment(activeSequence + 1);  // Don't extend a torn point
+      return false;
+    }
+    encoder = next;
+    codedBytes += length;
+    activeRecords++;
+    nextRecord++;
+    return true;
+  }
+
+  // Call fn(point, index) for every stored point, oldest first
+  template <typename F>
+  void forEach(F fn) {
+    if (!hasActive) return;
+    for (uint32_t sequence = oldestSequence(); sequence != activeSequence + 1; sequence++) {
+      DeltaSegmentFile segment;
+      if (!segment.open(fs, segmentPath(sequence))) continue;
+      if (segment.header.sequence != sequence) continue;
+      uint32_t index = segment.header.firstRecord;
+      PackedPoint point;
+      while (segment.next(point)) {
+        fn(point, index++);
+      }
+      segment.close();
+    }
+  }
+
+  // Remove every segment and start again from record 0
+  void clear() {
+    for (uint8_t slot = 0; slot < segmentCount; slot++) {
+      String path = slotPath(slot);
+      if (fs.exists(path)) fs.remove(path);
+    }
+    hasActive = false;
+    activeSequence = 0;
+    activeRecords = 0;
+    nextRecord = 0;
+    clearIndex();
+  }
+
+  // Index given to the first record of an empty log (keeps the numbering of
+  // a log being converted)
+  void setFirstRecord(uint32_t index) {
+    if (!hasActive) nextRecord = index;
+  }
+
+  // Index of the oldest record still stored
+  uint32_t oldestRecord() const {
+    if (!hasActive) return nextRecord;
+    for (uint32_t sequence = oldestSequence(); sequence != activeSequence + 1; sequence++) {
+      const DeltaSegmentIndex& entry = segmentIndex[sequence % segmentCount];
+      if (entry.valid && entry.sequence == sequence) return entry.firstRecord;
+    }
+    return nextRecord;
+  }
+
+  // Sequence of the segment holding record `index`, false if the record is
+  // not stored: the last segment starting at or before it (a missing
+  // segment counts as starting before)
+  bool findSegment(uint32_t index, uint32_t& sequence) const {
+    if (!hasActive || (int32_t)(index - nextRecord) >= 0) return false;
+    uint32_t low = oldestSequence();
+    uint32_t high = activeSequence;
+    while (low != high) {
+      uint32_t mid = low + (high - low + 1) / 2;
+      const DeltaSegmentIndex& entry = segmentIndex[mid % segmentCount];
+      if (entry.valid && entry.sequence == mid && (int32_t)(index - entry.firstRecord) < 0) {
+        high = mid - 1;
+      } else {
+        low = mid;
+      }
+    }
+    const DeltaSegmentIndex& entry = segmentIndex[low % segmentCount];
+    sequence = low;
+    return entry.valid && entry.sequence == low && (int32_t)(index - entry.firstRecord) >= 0;
+  }
+
+  // Close the active segment early so the next record starts a new one,
+  // e.g. to get changed user data into a header now. An empty active
+  // segment is rewritten in place.
+  bool rotate() {
+    if (!hasActive) return true;
+    return startSegment(activeRecords > 0 ? activeSequence + 1 : activeSequence);
+  }
+
+  // Owner data stamped into every new segment header
+  void setUserData(uint32_t value) { userData = value; }
+  uint32_t getUserData() const { return userData; }
+
+  uint32_t recordCount() const { return nextRecord; }
+  const SegmentLogStats& getStats() const { return stats; }
+  uint32_t getCodedBytes() const { return codedBytes; }
+
+  // Flash bytes written per payload byte (1.0 = every byte written once)
+  float writeAmplification() const {
+    return stats.payloadBytes > 0 ? (float)stats.flashBytes / stats.payloadBytes : 0.0;
+  }
+
+  // Packed point bytes per coded byte
+  float compressionRatio() const {
+    return codedBytes > 0 ? (float)stats.payloadBytes / codedBytes : 0.0;
+  }
+};
+
+#endif
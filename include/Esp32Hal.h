@@ -0,0 +1,71 @@
+// ESP32 implementations of the hardware interfaces (Hal.h)
+
+#ifndef ESP32_HAL_H
+#define ESP32_HAL_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "INA226.h"
+#include "Hal.h"
+#include "CharlieplexDisplay.h"
+
+// Arduino core time (esp_timer underneath)
+class ArduinoClock : public Clock {
+public:
+  uint32_t millis() override { return ::millis(); }
+  uint32_t micros() override { return ::micros(); }
+  uint64_t micros64() override { return esp_timer_get_time(); }
+};
+
+// INA226 on I2C, calibrated for the shunt on begin()
+class Ina226Sensor : public BatterySensor {
+private:
+  INA226& ina;
+  float maxCurrentA;
+  float shuntOhm;
+
+public:
+  Ina226Sensor(INA226& device, float maxCurrent, float shunt)
+    : ina(device), maxCurrentA(maxCurrent), shuntOhm(shunt) {}
+
+  bool begin() override {
+    if (!ina.begin()) return false;
+    ina.setMaxCurrentShunt(maxCurrentA, shuntOhm);
+    return true;
+  }
+
+  void configure(uint8_t average, uint8_t busConversion, uint8_t shuntConversion) override {
+    ina.setAverage(average);
+    ina.setBusVoltageConversionTime(busConversion);
+    ina.setShuntVoltageConversionTime(shuntConversion);
+  }
+
+  // Reading Mask/Enable clears the conversion-ready flag and releases ALERT
+  void acknowledge() override { ina.getAlertFlag(); }
+
+  SensorReading read() override {
+    SensorReading reading;
+    reading.voltage = ina.getBusVoltage();
+    reading.current = ina.getCurrent_mA() / 1000.0;  // Convert to Amps
+    return reading;
+  }
+};
+
+// The Charlieplexed 7-segment displays
+class CharlieplexOutput : public DisplayOutput {
+private:
+  CharlieplexDisplay& display;
+
+public:
+  explicit CharlieplexOutput(CharlieplexDisplay& target) : display(target) {}
+
+  void setBrightness(uint8_t percent) override { display.setBrightness(percent); }
+
+  bool show(float voltage, float soc, float current) override {
+    display.setVoltageAndSoc(voltage, soc);
+    display.setCurrent(current);
+    return display.commit();
+  }
+};
+
+#endif
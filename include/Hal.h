@@ -0,0 +1,71 @@
+// Hardware abstraction
+// The pieces of hardware the core logic depends on, as small interfaces:
+// time, the battery sensor and the display. Every scheduler (SOC updates,
+// logging, saves, display timing) reads time through a Clock. The firmware
+// implements them on the ESP32 (Esp32Hal.h) and the native build with
+// host fakes (src/host/HostHal.h), so SOC, logging and JSON code runs
+// unchanged on either.
+//
+// Storage needs no interface of its own: everything that touches flash
+// (SegmentLog, DeltaSegmentLog, SocStore) already takes an fs::FS, which is
+// LittleFS on the device and a directory-backed FS on the host.
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+// Monotonic time. The 32-bit counters wrap (millis after ~49 days, micros
+// after ~71 minutes), so compare them by subtraction only; micros64() is
+// time since boot and does not wrap.
+class Clock {
+public:
+  virtual ~Clock() {}
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;
+  virtual uint64_t micros64() = 0;
+};
+
+// Another clock running `factor` times faster, for soak tests. Scaling the
+// wrapping counters keeps differences between readings consistent, so code
+// that only subtracts them sees a clock that wraps sooner.
+class AcceleratedClock : public Clock {
+private:
+  Clock& base;
+  uint32_t factor;
+
+public:
+  AcceleratedClock(Clock& source, uint32_t speedup) : base(source), factor(speedup) {}
+
+  uint32_t millis() override { return base.millis() * factor; }
+  uint32_t micros() override { return base.micros() * factor; }
+  uint64_t micros64() override { return base.micros64() * factor; }
+};
+
+// Bus voltage and shunt current of the battery
+struct SensorReading {
+  float voltage;  // V
+  float current;  // A, positive = charging
+};
+
+class BatterySensor {
+public:
+  virtual ~BatterySensor() {}
+  virtual bool begin() = 0;
+  // Averaging and conversion times as INA226 register field values
+  virtual void configure(uint8_t average, uint8_t busConversion, uint8_t shuntConversion) = 0;
+  // Clear the conversion-ready flag (releases the alert line)
+  virtual void acknowledge() = 0;
+  virtual SensorReading read() = 0;
+};
+
+// The front panel: voltage, SOC and current
+class DisplayOutput {
+public:
+  virtual ~DisplayOutput() {}
+  virtual void setBrightness(uint8_t percent) = 0;
+  // Show a new reading; false if it could not be taken this time
+  virtual bool show(float voltage, float soc, float current) = 0;
+};
+
+#endif
@@ -0,0 +1,44 @@
+// Binary history format served at /data.bin
+// Little endian, packed: one header followed by `count` fixed-width
+// records, copied from the in-memory rings. A response thinned out by
+// max_points holds every n-th record (X-Record-Step header), spaced
+// intervalSec apart.
+// Value fields are stored as value / scale (scale 1.0 = IEEE float32).
+
+#ifndef HISTORY_FORMAT_H
+#define HISTORY_FORMAT_H
+
+#include <stdint.h>
+
+#define HISTORY_BIN_MAGIC 0x31484D42  // "BMH1"
+#define HISTORY_BIN_VERSION 3         // 2: raw points as HISTORY_FORMAT_PACKED, 3: epoch is a Unix minute
+
+// Record formats
+#define HISTORY_FORMAT_RAW 1     // uint32 t, float32 v, c, s
+#define HISTORY_FORMAT_ROLLUP 2  // uint32 t, float32 vMin, vMax, vMean, cMin, cMax, cMean, sMin, sMax, sMean, uint32 count
+#define HISTORY_FORMAT_PACKED 3  // uint32 t, uint16 v, int16 c, uint8 s
+
+struct __attribute__((packed)) HistoryBinHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;      // Offset of the first record
+  uint16_t recordSize;
+  uint16_t recordFormat;    // HISTORY_FORMAT_*
+  uint32_t count;           // Records following the header
+  uint32_t firstSequence;   // Sequence number of the first record
+  uint32_t intervalSec;     // Nominal spacing of the records
+  uint32_t epoch;           // Unix minute of timestamp 0, 0 = no wall clock (timestamps relative)
+  float voltageScale;
+  float currentScale;
+  float socScale;
+};
+
+// HISTORY_FORMAT_PACKED record: a packed raw point with its timestamp
+struct __attribute__((packed)) HistoryPackedRecord {
+  uint32_t timestamp;
+  uint16_t voltage;
+  int16_t current;
+  uint8_t soc;
+};
+
+#endif
@@ -0,0 +1,36 @@
+// JSON records served at /data
+// One object per record: t/v/c/s for raw points, and for rolled-up tiers
+// the mean as t/v/c/s plus min (vl, cl, sl) and max (vh, ch, sh). Used as
+// JsonArrayStream record formatters by the web server, and by the native
+// build's benchmark.
+
+#ifndef HISTORY_JSON_H
+#define HISTORY_JSON_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "PackedPoint.h"
+#include "RetentionTiers.h"
+
+// Format one raw point into `out`, returns the length (snprintf's: it did
+// not fit if >= size)
+inline size_t formatPointJson(char* out, size_t size, const DataPoint& point) {
+  int len = snprintf(out, size, "{\"t\":%lu,\"v\":%.1f,\"c\":%.1f,\"s\":%.1f}",
+                     (unsigned long)point.timestamp, point.voltage, point.current, point.soc);
+  return len > 0 ? len : 0;
+}
+
+// Format one rolled-up point into `out`, returns the length as above
+inline size_t formatRollupJson(char* out, size_t size, const RollupPoint& point) {
+  int len = snprintf(out, size,
+                     "{\"t\":%lu,\"v\":%.1f,\"vl\":%.1f,\"vh\":%.1f,"
+                     "\"c\":%.1f,\"cl\":%.1f,\"ch\":%.1f,"
+                     "\"s\":%.1f,\"sl\":%.1f,\"sh\":%.1f}",
+                     (unsigned long)point.timestamp,
+                     point.voltageMean, point.voltageMin, point.voltageMax,
+                     point.currentMean, point.currentMin, point.currentMax,
+                     point.socMean, point.socMin, point.socMax);
+  return len > 0 ? len : 0;
+}
+
+#endif
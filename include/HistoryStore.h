@@ -0,0 +1,217 @@
+// In-memory history: the raw tier and its roll-ups
+// Logged points go into a ring of packed points, dated by time anchors
+// (PackedPoint.h), and are folded into the hourly and daily tiers
+// (RetentionTiers.h). Everything that has to reach flash is handed to a
+// HistorySink, so the store itself never blocks on storage.
+//
+// One writer (the analytics task, or setup() while loading). Readers on
+// other tasks re-check the raw sequence after copying a point, the same
+// way HistoryRing readers do: the counters are published with release
+// after the point is written, and the oldest point of a full ring counts
+// as gone since the writer may be overwriting it.
+
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "PackedPoint.h"
+#include "RetentionTiers.h"
+
+// Receives every record the store wants persisted, in order
+class HistorySink {
+public:
+  virtual ~HistorySink() {}
+  virtual void savePoint(const PackedPoint& point) = 0;
+  virtual void saveAnchor(const TimeAnchor& anchor) = 0;  // Always before the point it dates
+  virtual void saveHour(const RollupPoint& hour) = 0;
+  virtual void saveDay(const RollupPoint& day) = 0;
+};
+
+template <size_t RAW_POINTS, size_t ANCHORS, size_t HOURS, size_t DAYS>
+class HistoryStore {
+private:
+  PackedPoint raw[RAW_POINTS];
+  std::atomic<uint32_t> rawCount;
+  std::atomic<uint32_t> rawNext;  // Points ever logged; point n lives in raw[n % RAW_POINTS]
+  TimeAnchors<ANCHORS> timeAnchors;
+  HistoryRing<RollupPoint, HOURS> hourlyLog;
+  HistoryRing<RollupPoint, DAYS> dailyLog;
+  RollupAccumulator hourAccumulator;
+  RollupAccumulator dayAccumulator;
+  HistorySink* sink;
+
+  // True if another task can read the point with this sequence number
+  bool holds(uint32_t sequence) const {
+    uint32_t next = rawNext.load(std::memory_order_acquire);
+    return next - sequence - 1 < rawCount.load(std::memory_order_relaxed) && next - sequence < RAW_POINTS;
+  }
+
+public:
+  HistoryStore()
+    : rawCount(0), rawNext(0), hourAccumulator(MINUTES_PER_HOUR),
+      dayAccumulator(MINUTES_PER_DAY), sink(nullptr) {}
+
+  // Where persisted records go (nullptr = keep in RAM only)
+  void setSink(HistorySink* target) { sink = target; }
+
+  // Log a point into the raw tier and the roll-ups
+  void log(const DataPoint& point, uint16_t intervalMinutes) {
+    store(point, intervalMinutes, true);
+    rollup(point);
+  }
+
+  // Add a point to the raw tier only: anchor its timestamp if it is not
+  // where the newest anchor puts it, then pack it into the ring (and hand
+  // both to the sink if `persist`)
+  void store(const DataPoint& point, uint16_t intervalMinutes, bool persist) {
+    if (timeAnchors.needsAnchor(rawNext, point.timestamp, intervalMinutes)) {
+      TimeAnchor anchor = {rawNext, point.timestamp, intervalMinutes, 0};
+      timeAnchors.add(anchor);
+      if (persist && sink) sink->saveAnchor(anchor);
+    }
+    PackedPoint packed = packPoint(point);
+    addPacked(packed);
+    if (persist && sink) sink->savePoint(packed);
+  }
+
+  // Add a packed point (already dated by the anchors) to the ring
+  void addPacked(const PackedPoint& point) {
+    uint32_t next = rawNext.load(std::memory_order_relaxed);
+    raw[next % RAW_POINTS] = point;
+    uint32_t count = rawCount.load(std::memory_order_relaxed);
+    if (count < RAW_POINTS) {
+      rawCount.store(count + 1, std::memory_order_relaxed);
+    }
+    rawNext.store(next + 1, std::memory_order_release);
+  }
+
+  // Same, numbered as log record `sequence` (when loading from flash)
+  void addPacked(const PackedPoint& point, uint32_t sequence) {
+    rawNext.store(sequence, std::memory_order_relaxed);
+    addPacked(point);
+  }
+
+  void addAnchor(const TimeAnchor& anchor) { timeAnchors.add(anchor); }
+
+  // Forget the raw tier and its anchors
+  void clearRaw() {
+    rawCount.store(0, std::memory_order_relaxed);
+    rawNext.store(0, std::memory_order_release);
+    timeAnchors.clear();
+  }
+
+  // Copy the packed point with this sequence number, false if it is not in
+  // the ring (any more)
+  bool getPacked(uint32_t sequence, PackedPoint& point) const {
+    if (!holds(sequence)) return false;
+    point = raw[sequence % RAW_POINTS];
+    // Overwritten by the writer while we were copying?
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return holds(sequence);
+  }
+
+  // Packed point with this sequence number, nullptr if not held. Writer's
+  // task only; unlike getPacked() it includes the oldest point of a full
+  // ring.
+  const PackedPoint* findPacked(uint32_t sequence) const {
+    if (rawNext - sequence - 1 >= rawCount) return nullptr;
+    return &raw[sequence % RAW_POINTS];
+  }
+
+  bool getPoint(uint32_t sequence, DataPoint& point) const {
+    PackedPoint packed;
+    if (!getPacked(sequence, packed)) return false;
+    point = unpackPoint(packed, timeAnchors.timestampOf(sequence));
+    return true;
+  }
+
+  uint32_t timestampOf(uint32_t sequence) const { return timeAnchors.timestampOf(sequence); }
+  uint32_t rawSequence() const { return rawNext.load(std::memory_order_acquire); }  // Sequence the next point will get
+  uint32_t rawOldest() const { return rawSequence() - rawCount.load(std::memory_order_relaxed); }
+  uint32_t rawSize() const { return rawCount.load(std::memory_order_relaxed); }
+  static constexpr size_t rawCapacity() { return RAW_POINTS; }
+  const TimeAnchors<ANCHORS>& anchors() const { return timeAnchors; }
+
+  HistoryRing<RollupPoint, HOURS>& hourly() { return hourlyLog; }
+  HistoryRing<RollupPoint, DAYS>& daily() { return dailyLog; }
+  const HistoryRing<RollupPoint, HOURS>& hourly() const { return hourlyLog; }
+  const HistoryRing<RollupPoint, DAYS>& daily() const { return dailyLog; }
+
+  // Fold a raw point into the hourly tier, finishing the previous hour when
+  // the point starts a new one
+  void rollup(const DataPoint& point) {
+    if (hourAccumulator.closes(point.timestamp)) {
+      RollupPoint hour = hourAccumulator.finish();
+      hourAccumulator.reset();
+      hourlyLog.push(hour);
+      if (sink) sink->saveHour(hour);
+      addHour(hour);
+    }
+    hourAccumulator.add(point.timestamp, point.voltage, point.current, point.soc);
+  }
+
+  // Fold a finished hour into the daily tier
+  void addHour(const RollupPoint& hour) {
+    if (dayAccumulator.closes(hour.timestamp)) {
+      RollupPoint day = dayAccumulator.finish();
+      dayAccumulator.reset();
+      dailyLog.push(day);
+      if (sink) sink->saveDay(day);
+    }
+    dayAccumulator.add(hour);
+  }
+
+  // Once the raw ring and both tiers are loaded: rebuild the partially
+  // filled buckets from the finer tier, finishing any bucket lost to a
+  // power cut
+  void resumeRollups() {
+    hourAccumulator.reset();
+    dayAccumulator.reset();
+
+    // Hours not yet folded into a finished day
+    uint32_t dayEnd = dailyLog.size() > 0 ? dailyLog.newest().timestamp + MINUTES_PER_DAY : 0;
+    for (size_t i = 0; i < hourlyLog.size(); i++) {
+      if (hourlyLog.at(i).timestamp >= dayEnd) {
+        addHour(hourlyLog.at(i));
+      }
+    }
+
+    // Raw points not yet folded into a finished hour
+    uint32_t hourEnd = hourlyLog.size() > 0 ? hourlyLog.newest().timestamp + MINUTES_PER_HOUR : 0;
+    for (uint32_t sequence = rawOldest(); sequence != rawNext; sequence++) {
+      const PackedPoint* packed = findPacked(sequence);
+      if (!packed) continue;
+      DataPoint point = unpackPoint(*packed, timestampOf(sequence));
+      if (point.timestamp >= hourEnd) {
+        rollup(point);
+      }
+    }
+  }
+};
+
+// First sequence number in [first, end) whose record is at or after
+// `minute`, by binary search: timestamps increase with the sequence number,
+// and a record timestampOf(sequence, timestamp) no longer finds counts as
+// older. Works for any tier; `scanned` counts the probes.
+template <typename F>
+uint32_t findFirstAtOrAfter(uint32_t first, uint32_t end, uint32_t minute, uint32_t& scanned, F timestampOf) {
+  uint32_t low = first;
+  uint32_t count = end - first;
+  while (count > 0) {
+    uint32_t half = count / 2;
+    uint32_t mid = low + half;
+    uint32_t timestamp;
+    scanned++;
+    if (!timestampOf(mid, timestamp) || timestamp < minute) {
+      low = mid + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+  return low;
+}
+
+#endif
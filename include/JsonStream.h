@@ -0,0 +1,132 @@
+// Streaming JSON array writer for chunked HTTP responses
+// Produces "<prefix>record,record,...<suffix>" in pieces no larger than the
+// buffer the web server hands us, formatting one record at a time into a
+// fixed scratch buffer. Nothing is allocated while streaming. Records can be
+// decimated (every step-th sequence number) and the suffix can be formatted
+// once the records are done, e.g. to report what streaming them cost.
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define JSON_STREAM_SCRATCH_SIZE 192
+
+class JsonArrayStream {
+public:
+  // Format the record with this sequence number into `out` (without a
+  // separator). Return the length written, or 0 to skip the record.
+  typedef size_t (*RecordFormatter)(char* out, size_t size, uint32_t sequence, void* context);
+  // Format the suffix into `out` after the last record, return its length
+  typedef size_t (*SuffixFormatter)(char* out, size_t size, void* context);
+
+private:
+  enum State {
+    STATE_PREFIX,
+    STATE_RECORDS,
+    STATE_SUFFIX,
+    STATE_DONE
+  };
+
+  RecordFormatter formatter;
+  void* context;
+  SuffixFormatter suffixFormatter;
+  uint32_t nextSequence;
+  uint32_t remaining;       // Records still to format
+  uint32_t step;
+  State state;
+  bool firstRecord;
+  char prefix[96];
+  const char* suffix;
+
+  char scratch[JSON_STREAM_SCRATCH_SIZE];
+  size_t scratchLen;
+  size_t scratchPos;
+
+  // Put the next piece of the document into scratch, false when finished
+  bool produce() {
+    scratchPos = 0;
+    scratchLen = 0;
+    switch (state) {
+      case STATE_PREFIX:
+        scratchLen = strlen(prefix);
+        memcpy(scratch, prefix, scratchLen);
+        state = STATE_RECORDS;
+        return true;
+
+      case STATE_RECORDS:
+        while (remaining > 0) {
+          uint32_t sequence = nextSequence;
+          nextSequence += step;
+          remaining--;
+          size_t offset = firstRecord ? 0 : 1;
+          size_t len = formatter(scratch + offset, sizeof(scratch) - offset, sequence, context);
+          if (len == 0 || len >= sizeof(scratch) - offset) continue;
+          if (!firstRecord) scratch[0] = ',';
+          firstRecord = false;
+          scratchLen = offset + len;
+          return true;
+        }
+        state = STATE_SUFFIX;
+        // Fall through
+
+      case STATE_SUFFIX:
+        if (suffixFormatter) {
+          scratchLen = suffixFormatter(scratch, sizeof(scratch), context);
+          if (scratchLen >= sizeof(scratch)) scratchLen = 0;
+        } else {
+          scratchLen = strlen(suffix);
+          memcpy(scratch, suffix, scratchLen);
+        }
+        state = STATE_DONE;
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+public:
+  // Stream records [first, end) - sequence numbers may wrap
+  JsonArrayStream(const char* documentPrefix, const char* documentSuffix,
+                  RecordFormatter recordFormatter, void* recordContext,
+                  uint32_t first, uint32_t end)
+    : formatter(recordFormatter), context(recordContext), suffixFormatter(nullptr),
+      nextSequence(first), remaining(end - first), step(1), state(STATE_PREFIX),
+      firstRecord(true), suffix(documentSuffix), scratchLen(0), scratchPos(0) {
+    strncpy(prefix, documentPrefix, sizeof(prefix) - 1);
+    prefix[sizeof(prefix) - 1] = '\0';
+  }
+
+  // Only every `every`-th record from the first (call once, before reading)
+  void setStep(uint32_t every) {
+    if (every == 0) every = 1;
+    remaining = remaining / every + (remaining % every ? 1 : 0);
+    step = every;
+  }
+
+  // Format the suffix with `fn` instead of using the fixed one
+  void setSuffixFormatter(SuffixFormatter fn) { suffixFormatter = fn; }
+
+  // Fill up to maxLen bytes, returns 0 once the document is complete
+  size_t read(uint8_t* buffer, size_t maxLen) {
+    size_t written = 0;
+    while (written < maxLen) {
+      if (scratchPos == scratchLen && !produce()) break;
+      size_t n = scratchLen - scratchPos;
+      if (n > maxLen - written) n = maxLen - written;
+      memcpy(buffer + written, scratch + scratchPos, n);
+      scratchPos += n;
+      written += n;
+    }
+    return written;
+  }
+
+  bool done() const {
+    return state == STATE_DONE && scratchPos == scratchLen;
+  }
+};
+
+#endif
@@ -0,0 +1,125 @@
+// Packed fixed-point log points
+// A logged point is kept as scaled integers, 5 bytes instead of a 16-byte
+// DataPoint, in the RAM ring and in the flash log alike. Timestamps are not
+// stored per point: points are logged at a fixed interval, so a short
+// table of time anchors (sequence number -> timestamp and interval) gives
+// them back. A new anchor is only needed when the interval changes or the
+// clock jumps, e.g. after a reboot.
+
+#ifndef PACKED_POINT_H
+#define PACKED_POINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "RetentionTiers.h"
+
+#define POINT_VOLTAGE_SCALE 0.01f   // V per count, 0 to 655.35 V
+#define POINT_CURRENT_SCALE 0.01f   // A per count, -327.68 to 327.67 A
+#define POINT_SOC_SCALE 0.5f        // % per count, 0 to 127.5 %
+#define ANCHOR_TOLERANCE_MINUTES 1  // Drift accepted before a point gets a new anchor
+
+// A log point as the rest of the code sees it
+struct DataPoint {
+  uint32_t timestamp;  // Timeline minute (TimeBase.h)
+  float voltage;
+  float current;
+  float soc;  // State of charge percentage
+};
+
+// A log point as stored
+struct __attribute__((packed)) PackedPoint {
+  uint16_t voltage;    // POINT_VOLTAGE_SCALE
+  int16_t current;     // POINT_CURRENT_SCALE
+  uint8_t soc;         // POINT_SOC_SCALE
+};
+
+// Points from `sequence` on are `intervalMinutes` apart, starting at `timestamp`
+struct TimeAnchor {
+  uint32_t sequence;
+  uint32_t timestamp;
+  uint16_t intervalMinutes;
+  uint16_t reserved;
+};
+
+// Round to the nearest count and clamp to the field's range
+inline int32_t scaleValue(float value, float scale, int32_t low, int32_t high) {
+  float counts = value / scale;
+  int32_t rounded = (int32_t)(counts + (counts >= 0 ? 0.5f : -0.5f));
+  if (rounded < low) return low;
+  if (rounded > high) return high;
+  return rounded;
+}
+
+inline PackedPoint packPoint(const DataPoint& point) {
+  PackedPoint packed;
+  packed.voltage = scaleValue(point.voltage, POINT_VOLTAGE_SCALE, 0, UINT16_MAX);
+  packed.current = scaleValue(point.current, POINT_CURRENT_SCALE, INT16_MIN, INT16_MAX);
+  packed.soc = scaleValue(point.soc, POINT_SOC_SCALE, 0, UINT8_MAX);
+  return packed;
+}
+
+inline DataPoint unpackPoint(const PackedPoint& packed, uint32_t timestamp) {
+  DataPoint point;
+  point.timestamp = timestamp;
+  point.voltage = packed.voltage * POINT_VOLTAGE_SCALE;
+  point.current = packed.current * POINT_CURRENT_SCALE;
+  point.soc = packed.soc * POINT_SOC_SCALE;
+  return point;
+}
+
+// The newest N anchors. Points older than the oldest one held are dated by
+// extrapolating it backwards.
+template <size_t N>
+class TimeAnchors {
+private:
+  HistoryRing<TimeAnchor, N + 1> anchors;  // One spare, so readers on other tasks still see N (HistoryRing)
+
+public:
+  void add(const TimeAnchor& anchor) { anchors.push(anchor); }
+  void clear() { anchors.clear(); }
+  size_t size() const { return anchors.size(); }
+  const TimeAnchor& at(size_t i) const { return anchors.at(i); }  // i = 0 is the oldest
+  static constexpr size_t capacity() { return N; }
+
+  // Timestamp of the point with this sequence number (0 with no anchors).
+  // Safe from any task: anchors are read with HistoryRing::get(), and one
+  // overwritten during the search counts as older than every point.
+  uint32_t timestampOf(uint32_t sequence) const {
+    // Binary search for the first anchor after the point; the one before it
+    // dates the point
+    uint32_t end = anchors.sequence();
+    uint32_t low = anchors.oldestSequence();
+    uint32_t count = end - low;
+    TimeAnchor anchor;
+    while (count > 0) {
+      uint32_t half = count / 2;
+      uint32_t mid = low + half;
+      if (!anchors.get(mid, anchor) || (int32_t)(sequence - anchor.sequence) >= 0) {
+        low = mid + 1;
+        count -= half + 1;
+      } else {
+        count = half;
+      }
+    }
+    if (anchors.get(low - 1, anchor)) {
+      return anchor.timestamp + (sequence - anchor.sequence) * anchor.intervalMinutes;
+    }
+    // Older than every anchor held: extrapolate the oldest one backwards
+    for (uint32_t ring = anchors.oldestSequence(); ring != end; ring++) {
+      if (anchors.get(ring, anchor)) {
+        return anchor.timestamp - (anchor.sequence - sequence) * anchor.intervalMinutes;
+      }
+    }
+    return 0;
+  }
+
+  // True if a point logged as `sequence` at `timestamp` is not where the
+  // newest anchor puts it
+  bool needsAnchor(uint32_t sequence, uint32_t timestamp, uint16_t intervalMinutes) const {
+    if (anchors.size() == 0 || anchors.newest().intervalMinutes != intervalMinutes) return true;
+    int32_t drift = (int32_t)(timestamp - timestampOf(sequence));
+    return drift > ANCHOR_TOLERANCE_MINUTES || drift < -ANCHOR_TOLERANCE_MINUTES;
+  }
+};
+
+#endif
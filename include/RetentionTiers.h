@@ -0,0 +1,184 @@
+// Multi-resolution (RRD-style) history
+// Raw log points are rolled up into hourly buckets and hourly buckets into
+// daily ones. Each tier keeps min/max/mean of voltage, current and SOC in
+// its own ring, so older history costs one record per hour or day.
+
+#ifndef RETENTION_TIERS_H
+#define RETENTION_TIERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define MINUTES_PER_HOUR 60
+#define MINUTES_PER_DAY 1440
+
+// One aggregated bucket
+struct RollupPoint {
+  uint32_t timestamp;  // Bucket start, minutes (same time base as DataPoint)
+  float voltageMin, voltageMax, voltageMean;
+  float currentMin, currentMax, currentMean;
+  float socMin, socMax, socMean;
+  uint32_t count;      // Raw points aggregated
+};
+
+// Fixed-size ring, oldest entry first when indexed. Every entry also has
+// a sequence number (entries ever pushed before it) so readers that work
+// across several calls can tell when an entry has been overwritten.
+//
+// One writer. Readers on other tasks only use get() (and the sequence
+// numbers): it copies the entry and then re-checks the counters, the same
+// way SampleRing readers do, and treats the oldest entry of a full ring
+// as gone since the writer may be overwriting it. at(), newest() and
+// find() are for the writer's task.
+template <typename T, size_t N>
+class HistoryRing {
+private:
+  T items[N];                     // Entry with sequence number s in items[s % N]
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> pushed;   // Published with release after the entry is written
+
+  // True if another task can read the entry with this sequence number
+  bool readable(uint32_t seq) const {
+    uint32_t end = pushed.load(std::memory_order_acquire);
+    return end - seq - 1 < count.load(std::memory_order_relaxed) && end - seq < N;
+  }
+
+public:
+  HistoryRing() : count(0), pushed(0) {}
+
+  void push(const T& item) {
+    uint32_t seq = pushed.load(std::memory_order_relaxed);
+    items[seq % N] = item;
+    uint32_t held = count.load(std::memory_order_relaxed);
+    if (held < N) count.store(held + 1, std::memory_order_relaxed);
+    pushed.store(seq + 1, std::memory_order_release);
+  }
+
+  // Same, numbered `seq` (when loading from a log that keeps the numbering
+  // across reboots). Entries before a gap in the numbering are dropped, so
+  // every held entry keeps the right sequence number.
+  void push(const T& item, uint32_t seq) {
+    if (seq != pushed.load(std::memory_order_relaxed)) clear(seq);
+    push(item);
+  }
+
+  // Sequence number the next push will get
+  uint32_t sequence() const { return pushed.load(std::memory_order_acquire); }
+  uint32_t oldestSequence() const {
+    uint32_t end = pushed.load(std::memory_order_acquire);
+    return end - count.load(std::memory_order_relaxed);
+  }
+
+  // Entry with this sequence number, nullptr if not (or no longer) held.
+  // Writer's task only.
+  const T* find(uint32_t seq) const {
+    if (pushed - seq - 1 >= count) return nullptr;
+    return &items[seq % N];
+  }
+
+  // Copy the entry with this sequence number, false if not (or no longer)
+  // held. Safe from any task.
+  bool get(uint32_t seq, T& out) const {
+    if (!readable(seq)) return false;
+    out = items[seq % N];
+    // Overwritten by the writer while we were copying?
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return readable(seq);
+  }
+
+  // i = 0 is the oldest entry
+  const T& at(size_t i) const {
+    return items[(pushed - count + i) % N];
+  }
+
+  const T& newest() const { return at(count - 1); }
+  size_t size() const { return count.load(std::memory_order_relaxed); }
+  // Empty the ring; the next push gets sequence number `firstSequence`
+  void clear(uint32_t firstSequence = 0) {
+    count.store(0, std::memory_order_relaxed);
+    pushed.store(firstSequence, std::memory_order_release);
+  }
+  static constexpr size_t capacity() { return N; }
+};
+
+// Accumulates points (or finished buckets) belonging to one bucket
+class RollupAccumulator {
+private:
+  uint32_t bucketMinutes;
+  uint32_t bucketStart;
+  RollupPoint bucket;
+  double voltageSum, currentSum, socSum;
+
+public:
+  explicit RollupAccumulator(uint32_t minutes) : bucketMinutes(minutes) {
+    reset();
+  }
+
+  void reset() {
+    bucketStart = 0;
+    bucket.count = 0;
+    voltageSum = currentSum = socSum = 0;
+  }
+
+  bool empty() const { return bucket.count == 0; }
+
+  uint32_t bucketFor(uint32_t timestamp) const {
+    return timestamp - (timestamp % bucketMinutes);
+  }
+
+  // True if a point at `timestamp` falls outside the bucket being built,
+  // i.e. the current bucket has to be finished first
+  bool closes(uint32_t timestamp) const {
+    return !empty() && bucketFor(timestamp) != bucketStart;
+  }
+
+  // Fold in a finished bucket of a finer tier (or a raw point, count = 1)
+  void add(const RollupPoint& p) {
+    if (empty()) {
+      bucketStart = bucketFor(p.timestamp);
+      bucket = p;
+      bucket.timestamp = bucketStart;
+      voltageSum = (double)p.voltageMean * p.count;
+      currentSum = (double)p.currentMean * p.count;
+      socSum = (double)p.socMean * p.count;
+      return;
+    }
+    if (p.voltageMin < bucket.voltageMin) bucket.voltageMin = p.voltageMin;
+    if (p.voltageMax > bucket.voltageMax) bucket.voltageMax = p.voltageMax;
+    if (p.currentMin < bucket.currentMin) bucket.currentMin = p.currentMin;
+    if (p.currentMax > bucket.currentMax) bucket.currentMax = p.currentMax;
+    if (p.socMin < bucket.socMin) bucket.socMin = p.socMin;
+    if (p.socMax > bucket.socMax) bucket.socMax = p.socMax;
+    voltageSum += (double)p.voltageMean * p.count;
+    currentSum += (double)p.currentMean * p.count;
+    socSum += (double)p.socMean * p.count;
+    bucket.count += p.count;
+  }
+
+  void add(uint32_t timestamp, float voltage, float current, float soc) {
+    add(point(timestamp, voltage, current, soc));
+  }
+
+  // Finished bucket; call reset() afterwards to start the next one
+  RollupPoint finish() const {
+    RollupPoint result = bucket;
+    result.voltageMean = voltageSum / bucket.count;
+    result.currentMean = currentSum / bucket.count;
+    result.socMean = socSum / bucket.count;
+    return result;
+  }
+
+  // A raw reading as a single-point bucket
+  static RollupPoint point(uint32_t timestamp, float voltage, float current, float soc) {
+    RollupPoint p;
+    p.timestamp = timestamp;
+    p.voltageMin = p.voltageMax = p.voltageMean = voltage;
+    p.currentMin = p.currentMax = p.currentMean = current;
+    p.socMin = p.socMax = p.socMean = soc;
+    p.count = 1;
+    return p;
+  }
+};
+
+#endif
@@ -0,0 +1,95 @@
+// Lock-free sample ring for INA226 readings
+// Single producer (the sampling task), any number of readers
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// One INA226 conversion
+struct Sample {
+  uint32_t timestampUs;  // systemClock.micros() when the reading was taken
+  float voltage;         // Bus voltage (V)
+  float current;         // Current (A), positive = charging
+};
+
+// Ring buffer of the most recent samples.
+//
+// The producer writes the slot first and then publishes it by advancing
+// `head` (the total number of samples ever pushed). Readers never block the
+// producer: they copy a slot and then re-check `head` - if the producer has
+// lapped the slot while it was being copied, the copy is thrown away.
+// Each reader keeps its own cursor, so consumers running at different rates
+// do not interfere with each other.
+template <size_t N>
+class SampleRing {
+private:
+  Sample slots[N];
+  std::atomic<uint32_t> head;
+
+  // True if the slot for sequence `seq` can no longer be overwritten
+  // while we are (or were) reading it
+  bool stillValid(uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return head.load(std::memory_order_relaxed) - seq < N;
+  }
+
+public:
+  SampleRing() : head(0) {}
+
+  // Producer only
+  void push(const Sample& sample) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    slots[h % N] = sample;
+    head.store(h + 1, std::memory_order_release);
+  }
+
+  // Total number of samples ever published (wraps at 2^32)
+  uint32_t published() const {
+    return head.load(std::memory_order_acquire);
+  }
+
+  // Copy the newest sample, returns false if nothing has been published yet
+  bool latest(Sample& out) const {
+    for (int attempt = 0; attempt < 4; attempt++) {
+      uint32_t h = head.load(std::memory_order_acquire);
+      if (h == 0) return false;
+      uint32_t seq = h - 1;
+      out = slots[seq % N];
+      if (stillValid(seq)) return true;
+    }
+    return false;
+  }
+
+  // Copy up to `maxCount` samples published after `cursor` and advance it.
+  // If the reader fell more than N samples behind, the oldest samples are
+  // skipped and counted in `dropped`.
+  size_t readSince(uint32_t& cursor, Sample* out, size_t maxCount, uint32_t* dropped = nullptr) {
+    uint32_t h = head.load(std::memory_order_acquire);
+    if (h - cursor > N) {
+      if (dropped) *dropped += (h - cursor) - N;
+      cursor = h - N;
+    }
+
+    size_t count = 0;
+    while (count < maxCount && cursor != h) {
+      out[count] = slots[cursor % N];
+      if (!stillValid(cursor)) {
+        // Lapped while copying - resynchronise on the next call
+        uint32_t now = head.load(std::memory_order_acquire);
+        if (dropped) *dropped += (now - cursor) - (N - 1);
+        cursor = now - (N - 1);
+        break;
+      }
+      cursor++;
+      count++;
+    }
+    return count;
+  }
+
+  static constexpr size_t capacity() { return N; }
+};
+
+#endif
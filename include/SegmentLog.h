@@ -0,0 +1,215 @@
+// Append-only segmented record log on LittleFS
+// Records are written once, at the end of the active segment file. When a
+// segment is full the oldest segment file is recycled, so flash wear is
+// proportional to the data actually logged instead of the log size.
+
+#ifndef SEGMENT_LOG_H
+#define SEGMENT_LOG_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define SEGMENT_MAGIC 0x474C5342  // "BSLG"
+#define SEGMENT_VERSION 1
+
+// Written once at the start of every segment file
+struct SegmentHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t sequence;      // Increases by one per segment, never reused
+  uint32_t firstRecord;   // Log-wide index of the first record in this segment
+  uint32_t userData;      // Owner defined (e.g. time base of the records)
+};
+
+// Write amplification bookkeeping
+struct SegmentLogStats {
+  uint32_t payloadBytes;  // Record bytes handed to append()
+  uint32_t flashBytes;    // Bytes actually written (records + segment headers)
+  uint32_t segmentsRotated;
+};
+
+class SegmentLog {
+private:
+  fs::FS& fs;
+  const char* dir;
+  uint16_t recordSize;
+  uint16_t recordsPerSegment;
+  uint8_t segmentCount;
+
+  bool hasActive;
+  uint32_t activeSequence;
+  uint32_t activeRecords;     // Records in the active segment
+  uint32_t nextRecord;        // Log-wide index of the next record
+  uint32_t userData;
+  SegmentLogStats stats;
+
+  String segmentPath(uint32_t sequence) const {
+    return String(dir) + "/" + String(sequence % segmentCount) + ".seg";
+  }
+
+  // Read and validate a segment header, returns the number of whole
+  // records in the file or -1 if the file is missing or not a segment
+  int readSegment(uint8_t slot, SegmentHeader& header) {
+    String path = String(dir) + "/" + String(slot) + ".seg";
+    if (!fs.exists(path)) return -1;
+    File file = fs.open(path, "r");
+    if (!file) return -1;
+    size_t size = file.size();
+    size_t got = file.read((uint8_t*)&header, sizeof(header));
+    file.close();
+    if (got != sizeof(header) || header.magic != SEGMENT_MAGIC ||
+        header.version != SEGMENT_VERSION || header.recordSize != recordSize) {
+      return -1;
+    }
+    return (size - sizeof(header)) / recordSize;
+  }
+
+  bool startSegment(uint32_t sequence) {
+    File file = fs.open(segmentPath(sequence), "w");  // Recycles the oldest segment
+    if (!file) {
+      Serial.println("Failed to open log segment for writing");
+      return false;
+    }
+    SegmentHeader header = {SEGMENT_MAGIC, SEGMENT_VERSION, recordSize, sequence, nextRecord, userData};
+    size_t written = file.write((uint8_t*)&header, sizeof(header));
+    file.close();
+    stats.flashBytes += written;
+    if (written != sizeof(header)) {
+      Serial.println("Failed to write log segment header");
+      return false;
+    }
+    if (hasActive) stats.segmentsRotated++;
+    hasActive = true;
+    activeSequence = sequence;
+    activeRecords = 0;
+    return true;
+  }
+
+public:
+  SegmentLog(fs::FS& filesystem, const char* directory, uint16_t recordBytes,
+             uint16_t perSegment, uint8_t segments)
+    : fs(filesystem), dir(directory), recordSize(recordBytes),
+      recordsPerSegment(perSegment), segmentCount(segments) {
+    hasActive = false;
+    activeSequence = 0;
+    activeRecords = 0;
+    nextRecord = 0;
+    userData = 0;
+    stats = {0, 0, 0};
+  }
+
+  // Scan segment headers to find where the log ends.
+  // Returns true if existing records were found.
+  bool begin() {
+    if (!fs.exists(dir)) {
+      fs.mkdir(dir);
+    }
+
+    bool found = false;
+    SegmentHeader newest;
+    int newestRecords = 0;
+    for (uint8_t slot = 0; slot < segmentCount; slot++) {
+      SegmentHeader header;
+      int records = readSegment(slot, header);
+      if (records < 0) continue;
+      if (!found || (int32_t)(header.sequence - newest.sequence) > 0) {
+        newest = header;
+        newestRecords = records;
+        found = true;
+      }
+    }
+
+    if (!found) return false;
+
+    hasActive = true;
+    activeSequence = newest.sequence;
+    activeRecords = newestRecords;
+    nextRecord = newest.firstRecord + newestRecords;
+    userData = newest.userData;
+
+    // A torn write can leave a partial record at the end; appending after
+    // it would misalign everything, so continue in a fresh segment
+    File file = fs.open(segmentPath(activeSequence), "r");
+    bool aligned = file && ((file.size() - sizeof(SegmentHeader)) % recordSize) == 0;
+    if (file) file.close();
+    if (!aligned || activeRecords >= recordsPerSegment) {
+      startSegment(activeSequence + 1);
+    }
+    return nextRecord > 0;
+  }
+
+  bool append(const void* record) {
+    if (!hasActive || activeRecords >= recordsPerSegment) {
+      if (!startSegment(hasActive ? activeSequence + 1 : 0)) return false;
+    }
+
+    File file = fs.open(segmentPath(activeSequence), "a");
+    if (!file) {
+      Serial.println("Failed to open log segment for appending");
+      return false;
+    }
+    size_t written = file.write((const uint8_t*)record, recordSize);
+    file.close();
+
+    stats.payloadBytes += recordSize;
+    stats.flashBytes += written;
+    if (written != recordSize) {
+      Serial.println("Failed to append log record");
+      return false;
+    }
+    activeRecords++;
+    nextRecord++;
+    return true;
+  }
+
+  // Call fn(record, index) for every stored record, oldest first
+  template <typename F>
+  void forEach(F fn) {
+    if (!hasActive) return;
+    uint8_t buffer[64];
+    if (recordSize > sizeof(buffer)) return;
+
+    uint32_t oldest = activeSequence >= (uint32_t)(segmentCount - 1) ? activeSequence - (segmentCount - 1) : 0;
+    for (uint32_t sequence = oldest; sequence != activeSequence + 1; sequence++) {
+      SegmentHeader header;
+      int records = readSegment(sequence % segmentCount, header);
+      if (records <= 0 || header.sequence != sequence) continue;
+
+      File file = fs.open(segmentPath(sequence), "r");
+      if (!file) continue;
+      file.seek(sizeof(SegmentHeader));
+      for (int i = 0; i < records; i++) {
+        if (file.read(buffer, recordSize) != recordSize) break;
+        fn(buffer, header.firstRecord + i);
+      }
+      file.close();
+    }
+  }
+
+  // Remove every segment and start again from record 0
+  void clear() {
+    for (uint8_t slot = 0; slot < segmentCount; slot++) {
+      String path = String(dir) + "/" + String(slot) + ".seg";
+      if (fs.exists(path)) fs.remove(path);
+    }
+    hasActive = false;
+    activeSequence = 0;
+    activeRecords = 0;
+    nextRecord = 0;
+  }
+
+  // Owner data stamped into every new segment header
+  void setUserData(uint32_t value) { userData = value; }
+  uint32_t getUserData() const { return userData; }
+
+  uint32_t recordCount() const { return nextRecord; }
+  const SegmentLogStats& getStats() const { return stats; }
+
+  // Flash bytes written per payload byte (1.0 = every byte written once)
+  float writeAmplification() const {
+    return stats.payloadBytes > 0 ? (float)stats.flashBytes / stats.payloadBytes : 0.0;
+  }
+};
+
+#endif
@@ -0,0 +1,127 @@
+// Crash-consistent SOC storage
+// The state is written alternately to two files, each holding one complete
+// record with a sequence number and a CRC. A write cut short by a power
+// loss can only damage the older copy, and load() returns the newest
+// record whose CRC checks out.
+
+#ifndef SOC_STORE_H
+#define SOC_STORE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "Crc32.h"
+
+#define SOC_STORE_MAGIC 0x43534D42  // "BMSC"
+#define SOC_STORE_VERSION 1
+#define SOC_NEVER_FULL 0xFFFFFFFF   // lastFullTime before the first full detection
+
+// Everything needed to resume SOC tracking after a reboot
+struct SocState {
+  int64_t chargedMaUs;       // Lifetime charge into the battery (coulomb counter)
+  int64_t dischargedMaUs;    // Lifetime charge out of the battery
+  float socPercentage;
+  float ampHoursRemaining;
+  uint32_t lastFullTime;     // Log time (minutes) of the last full detection
+  uint32_t reserved;         // Fills the struct to 8-byte alignment, always 0
+};
+
+// One slot file. Fields are ordered so nothing the CRC covers is padding.
+struct SocRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;             // sizeof(SocRecord)
+  uint32_t sequence;         // Increases by one per save, the newest valid slot wins
+  uint32_t reserved;
+  SocState state;
+  uint32_t crc;              // CRC-32 of everything before it
+};
+
+class SocStore {
+private:
+  fs::FS& fs;
+  const char* slotPaths[2];
+  uint32_t sequence;         // Of the newest valid record
+  uint8_t nextSlot;          // Slot the next save() overwrites (the older one)
+  bool hasRecord;
+
+  // Read one slot, false if it is missing, short or fails the CRC
+  bool readSlot(uint8_t slot, SocRecord& record) {
+    if (!fs.exists(slotPaths[slot])) return false;
+    File file = fs.open(slotPaths[slot], "r");
+    if (!file) return false;
+    size_t got = file.read((uint8_t*)&record, sizeof(record));
+    file.close();
+    return got == sizeof(record) &&
+           record.magic == SOC_STORE_MAGIC &&
+           record.version == SOC_STORE_VERSION &&
+           record.size == sizeof(record) &&
+           record.crc == crc32(&record, offsetof(SocRecord, crc));
+  }
+
+public:
+  SocStore(fs::FS& filesystem, const char* slot0, const char* slot1)
+    : fs(filesystem), sequence(0), nextSlot(0), hasRecord(false) {
+    slotPaths[0] = slot0;
+    slotPaths[1] = slot1;
+  }
+
+  // Newest valid state, false if neither slot holds one
+  bool load(SocState& state) {
+    SocRecord records[2];
+    bool valid[2];
+    for (uint8_t slot = 0; slot < 2; slot++) {
+      valid[slot] = readSlot(slot, records[slot]);
+    }
+
+    int newest = -1;
+    if (valid[0] && valid[1]) {
+      newest = (int32_t)(records[1].sequence - records[0].sequence) > 0 ? 1 : 0;
+    } else if (valid[0]) {
+      newest = 0;
+    } else if (valid[1]) {
+      newest = 1;
+    }
+    if (newest < 0) return false;
+
+    state = records[newest].state;
+    sequence = records[newest].sequence;
+    nextSlot = 1 - newest;
+    hasRecord = true;
+    return true;
+  }
+
+  // Write the state over the older slot. The newer slot is not touched, so
+  // whatever happens during the write one good copy remains.
+  bool save(const SocState& state) {
+    SocRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = SOC_STORE_MAGIC;
+    record.version = SOC_STORE_VERSION;
+    record.size = sizeof(record);
+    record.sequence = hasRecord ? sequence + 1 : 0;
+    record.state = state;
+    record.state.reserved = 0;
+    record.crc = crc32(&record, offsetof(SocRecord, crc));
+
+    File file = fs.open(slotPaths[nextSlot], "w");
+    if (!file) {
+      Serial.println("Failed to open SOC slot for writing");
+      return false;
+    }
+    size_t written = file.write((uint8_t*)&record, sizeof(record));
+    file.close();
+    if (written != sizeof(record)) {
+      Serial.println("Failed to write SOC slot");
+      return false;
+    }
+
+    sequence = record.sequence;
+    hasRecord = true;
+    nextSlot = 1 - nextSlot;
+    return true;
+  }
+
+  uint32_t getSequence() const { return sequence; }
+};
+
+#endif
@@ -0,0 +1,153 @@
+// State of charge tracking
+// Applies the charge integrated by the CoulombCounter to the remaining
+// amp-hours, with a Peukert correction on discharge, and resets to 100 %
+// once the battery has sat above the full voltage with a tapered charge
+// current for long enough. It has no hardware or clock of its own: the
+// caller passes in the totals, the latest reading and the time.
+//
+// Copyable, so an update can be computed on a copy and copied back;
+// `revision` tells whether the original was changed in between.
+
+#ifndef SOC_TRACKER_H
+#define SOC_TRACKER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "CoulombCounter.h"
+#include "SocStore.h"
+
+class SocTracker {
+private:
+  float capacityAh;
+  float peukertExponent;
+  float fullVoltage;
+  uint32_t fullDetectionMs;
+
+  SocState state;
+  CoulombTotals lastApplied;   // Totals at the previous update
+  uint32_t fullDetectionStart; // millis when the full conditions were first met, 0 = not met
+  bool wasFull;
+  uint32_t revision;           // Counts changes made through the setters
+
+public:
+  SocTracker(float capacity, float peukert, float fullV, uint32_t detectionMs)
+    : capacityAh(capacity), peukertExponent(peukert), fullVoltage(fullV), fullDetectionMs(detectionMs) {
+    memset(&state, 0, sizeof(state));
+    state.lastFullTime = SOC_NEVER_FULL;
+    memset(&lastApplied, 0, sizeof(lastApplied));
+    fullDetectionStart = 0;
+    wasFull = false;
+    revision = 0;
+    setFull();
+  }
+
+  float getCapacity() const { return capacityAh; }
+
+  // Change the capacity, keeping the SOC percentage
+  void setCapacity(float ah) {
+    capacityAh = ah;
+    revision++;
+    state.ampHoursRemaining = capacityAh * (state.socPercentage / 100.0);
+  }
+
+  // Charge counted before these totals is not applied
+  void setBaseline(const CoulombTotals& totals) {
+    lastApplied = totals;
+    revision++;
+  }
+
+  // Apply the charge integrated since the last update, then check for a
+  // full battery. Returns true if the battery was just detected as full.
+  // `logMinutes` is the log time recorded as the last full time.
+  bool update(const CoulombTotals& totals, float voltage, float current,
+              uint32_t nowMs, uint32_t logMinutes) {
+    int64_t chargedMaUs = totals.chargedMaUs - lastApplied.chargedMaUs;
+    int64_t dischargedMaUs = totals.dischargedMaUs - lastApplied.dischargedMaUs;
+    int64_t dischargeTimeUs = totals.dischargeTimeUs - lastApplied.dischargeTimeUs;
+    lastApplied = totals;
+    state.chargedMaUs += chargedMaUs;
+    state.dischargedMaUs += dischargedMaUs;
+
+    float ahCharged = (double)chargedMaUs / MA_US_PER_AH;
+    float ahDischarged = (double)dischargedMaUs / MA_US_PER_AH;
+
+    // Apply Peukert correction to the discharged part, using the average
+    // discharge current over the time actually spent discharging
+    if (dischargeTimeUs > 0 && ahDischarged > 0) {
+      float dischargeCurrent = ahDischarged / (dischargeTimeUs / 3600000000.0);
+      // Peukert correction factor: (I / C20)^(n-1)
+      float c20Rate = capacityAh / 20.0;
+      float peukertFactor = pow(dischargeCurrent / c20Rate, peukertExponent - 1.0);
+      ahDischarged *= peukertFactor;  // Increases effective consumption at higher discharge rates
+    }
+    // When charging (positive current), no Peukert correction needed
+
+    state.ampHoursRemaining += ahCharged - ahDischarged;
+
+    // Clamp to battery capacity
+    if (state.ampHoursRemaining > capacityAh) {
+      state.ampHoursRemaining = capacityAh;
+    }
+    if (state.ampHoursRemaining < 0) {
+      state.ampHoursRemaining = 0;
+    }
+
+    state.socPercentage = (state.ampHoursRemaining / capacityAh) * 100.0;
+
+    return checkFull(voltage, current, nowMs, logMinutes);
+  }
+
+  // Check if battery is full and reset SOC to 100%
+  bool checkFull(float voltage, float current, uint32_t nowMs, uint32_t logMinutes) {
+    // Calculate full current threshold as percentage of capacity
+    // Use C/200 rate (1% of capacity) as taper threshold
+    float fullCurrentThreshold = capacityAh / 100.0;
+
+    // Detect full battery:
+    // 1. Voltage >= threshold
+    // 2. CHARGING (current > 0, not discharging)
+    // 3. Charge current has tapered below threshold
+    if (voltage >= fullVoltage && current > 0 && current < fullCurrentThreshold) {
+      if (!wasFull) {
+        // Start timing
+        if (fullDetectionStart == 0) {
+          fullDetectionStart = nowMs;
+        }
+
+        // Check if conditions held for required time
+        if (nowMs - fullDetectionStart >= fullDetectionMs) {
+          setFull();
+          wasFull = true;
+          state.lastFullTime = logMinutes;
+          return true;
+        }
+      }
+    } else {
+      // Conditions not met, reset detection
+      fullDetectionStart = 0;
+      wasFull = false;
+    }
+    return false;
+  }
+
+  // Set SOC to 100%
+  void setFull() {
+    state.socPercentage = 100.0;
+    state.ampHoursRemaining = capacityAh;
+    revision++;
+  }
+
+  const SocState& getState() const { return state; }
+  void setState(const SocState& saved) {
+    state = saved;
+    revision++;
+  }
+
+  float getSoc() const { return state.socPercentage; }
+  float getAmpHoursRemaining() const { return state.ampHoursRemaining; }
+  uint32_t getLastFullTime() const { return state.lastFullTime; }
+  uint32_t getRevision() const { return revision; }
+};
+
+#endif
@@ -0,0 +1,83 @@
+// Log time base
+// Record timestamps are minutes on one timeline that carries on across
+// reboots and never wraps: the 64-bit uptime of this boot plus the minute
+// the timeline had reached when the boot started. Once a client has
+// supplied the wall-clock time, the Unix minute of timeline minute 0 (the
+// epoch, kept in the log segment headers) makes every timestamp absolute.
+//
+// Written by setup() and the web handler that receives the wall clock,
+// read by the analytics task; each field is atomic and a reader that sees
+// one update before the other is off by the correction for one call.
+
+#ifndef TIME_BASE_H
+#define TIME_BASE_H
+
+#include <stdint.h>
+#include <atomic>
+#include "Hal.h"
+
+#define WALL_CLOCK_MIN_EPOCH 26297280u   // 2020-01-01 in Unix minutes; anything earlier is not a wall clock
+#define WALL_CLOCK_MAX_EPOCH 68374080u   // 2100-01-01; anything later is not a wall clock either
+#define WALL_CLOCK_TOLERANCE_MINUTES 2   // Client clock differences ignored when re-syncing
+#define WALL_CLOCK_MAX_JUMP_MINUTES 43200u  // Longest power-off a re-sync catches up (30 days), on top of the uptime
+
+// What setWallClock() did with a client's time
+enum WallClockResult {
+  WALL_CLOCK_IGNORED,   // Within tolerance, or behind the timeline
+  WALL_CLOCK_SET,       // First wall clock: the epoch is set and needs saving
+  WALL_CLOCK_ADJUSTED,  // Timeline moved forward over time the monitor was off
+  WALL_CLOCK_REJECTED   // Not a plausible wall clock, or too far ahead
+};
+
+class TimeBase {
+private:
+  Clock& clock;
+  std::atomic<uint32_t> startMinute;  // Timeline minute at uptime 0
+  std::atomic<uint32_t> epoch;        // Unix minute of timeline minute 0, 0 = no wall clock yet
+  std::atomic<bool> adjusted;         // Timeline already moved forward this boot
+
+public:
+  explicit TimeBase(Clock& source) : clock(source), startMinute(0), epoch(0), adjusted(false) {}
+
+  uint64_t uptimeUs() { return clock.micros64(); }
+
+  // Current timeline minute
+  uint32_t now() { return startMinute + (uint32_t)(uptimeUs() / 60000000ULL); }
+
+  // Continue a stored timeline from `minute` (the current minute becomes
+  // that, whatever the uptime). `storedEpoch` is the epoch from the log;
+  // values that are not wall-clock minutes (e.g. an old boot time) are
+  // dropped.
+  void resume(uint32_t minute, uint32_t storedEpoch) {
+    startMinute = minute - (uint32_t)(uptimeUs() / 60000000ULL);
+    epoch = storedEpoch >= WALL_CLOCK_MIN_EPOCH ? storedEpoch : 0;
+  }
+
+  // Wall-clock time from a client, in Unix seconds. The first one fixes
+  // the epoch; a later one moves the timeline forward by whatever it
+  // missed while the monitor was off. The timeline never moves back, and
+  // since the move cannot be undone (and any client on the access point
+  // can send a time) it is made at most once per boot and only by up to
+  // the uptime plus WALL_CLOCK_MAX_JUMP_MINUTES.
+  WallClockResult setWallClock(uint32_t unixSeconds) {
+    uint32_t unixMinute = unixSeconds / 60;
+    if (unixMinute < WALL_CLOCK_MIN_EPOCH || unixMinute > WALL_CLOCK_MAX_EPOCH) return WALL_CLOCK_REJECTED;
+    uint32_t current = now();
+    if (epoch == 0) {
+      epoch = unixMinute - current;
+      return WALL_CLOCK_SET;
+    }
+    int32_t behind = (int32_t)(unixMinute - epoch - current);
+    if (behind <= WALL_CLOCK_TOLERANCE_MINUTES) return WALL_CLOCK_IGNORED;
+    uint32_t uptimeMinutes = (uint32_t)(uptimeUs() / 60000000ULL);
+    if (adjusted || (uint32_t)behind > uptimeMinutes + WALL_CLOCK_MAX_JUMP_MINUTES) return WALL_CLOCK_REJECTED;
+    startMinute += behind;
+    adjusted = true;
+    return WALL_CLOCK_ADJUSTED;
+  }
+
+  bool hasWallClock() const { return epoch != 0; }
+  uint32_t getEpoch() const { return epoch; }
+};
+
+#endif
@@ -0,0 +1,101 @@
+// Minimal Arduino core for the native build
+// Just the parts the shared headers in include/ use: String, Serial and the
+// time functions. Serial prints to stdout.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define DEC 10
+
+class String {
+private:
+  std::string text;
+
+public:
+  String() {}
+  String(const char* value) : text(value ? value : "") {}
+  String(const std::string& value) : text(value) {}
+  String(char value) : text(1, value) {}
+  String(int value) : text(std::to_string(value)) {}
+  String(unsigned int value) : text(std::to_string(value)) {}
+  String(long value) : text(std::to_string(value)) {}
+  String(unsigned long value) : text(std::to_string(value)) {}
+  String(float value, unsigned char decimals = 2) { format(value, decimals); }
+  String(double value, unsigned char decimals = 2) { format(value, decimals); }
+
+  String& operator+=(const String& other) { text += other.text; return *this; }
+  String& operator+=(const char* other) { text += other; return *this; }
+  String& operator+=(char other) { text += other; return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a.text + b.text); }
+  friend String operator+(const char* a, const String& b) { return String(a + b.text); }
+  friend String operator+(const String& a, const char* b) { return String(a.text + b); }
+  bool operator==(const String& other) const { return text == other.text; }
+  bool operator==(const char* other) const { return text == other; }
+  bool operator!=(const String& other) const { return text != other.text; }
+  bool operator!=(const char* other) const { return text != other; }
+
+  size_t length() const { return text.size(); }
+  const char* c_str() const { return text.c_str(); }
+  bool reserve(size_t size) { text.reserve(size); return true; }
+  long toInt() const { return atol(text.c_str()); }
+  float toFloat() const { return atof(text.c_str()); }
+
+private:
+  void format(double value, unsigned char decimals) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    text = buffer;
+  }
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+
+  size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+  size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  // Decimal only
+  size_t print(int n, int = DEC) { return print(String(n)); }
+  size_t print(unsigned int n, int = DEC) { return print(String(n)); }
+  size_t print(long n, int = DEC) { return print(String(n)); }
+  size_t print(unsigned long n, int = DEC) { return print(String(n)); }
+  size_t print(double n, int digits = 2) { return print(String(n, digits)); }
+
+  size_t println() { return print("\n"); }
+  template <typename T> size_t println(T value) { return print(value) + println(); }
+  template <typename T> size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+class HardwareSerial : public Print {
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+  size_t write(const uint8_t* buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+};
+
+extern HardwareSerial Serial;
+
+// Wall time since the program started
+unsigned long millis();
+unsigned long micros();
+
+#endif
@@ -0,0 +1,50 @@
+// Benchmark support: the heap meter and --bench dispatch
+
+#include <Arduino.h>
+#include <new>
+#include <chrono>
+#include "Benchmark.h"
+
+HeapMeter heapMeter = {0, 0, 0};
+
+// Every block carries its size in front, so delete can account for it
+union HeapBlock {
+  size_t size;
+  max_align_t align;
+};
+
+void* operator new(size_t size) {
+  HeapBlock* block = (HeapBlock*)malloc(sizeof(HeapBlock) + size);
+  if (!block) throw std::bad_alloc();
+  block->size = size;
+  heapMeter.current += size;
+  heapMeter.peak = max(heapMeter.peak, heapMeter.current);
+  heapMeter.allocations++;
+  return block + 1;
+}
+
+void operator delete(void* pointer) noexcept {
+  if (!pointer) return;
+  HeapBlock* block = (HeapBlock*)pointer - 1;
+  heapMeter.current -= block->size;
+  free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* pointer) noexcept { operator delete(pointer); }
+
+uint64_t benchMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int runBenchmark(const char* name, BenchmarkInput& input) {
+  String which = name;
+  if (which == "json") return runJsonBenchmark();
+  if (which == "codec") return runCodecBenchmark(input);
+  if (which == "accuracy") return runAccuracyBenchmark();
+  Serial.print("Unknown benchmark ");
+  Serial.println(name);
+  Serial.println("Benchmarks: json, codec, accuracy");
+  return 2;
+}
@@ -0,0 +1,50 @@
+// Native build benchmarks
+// Run with --bench NAME instead of a trace replay. Times come from the
+// host's steady clock, so they compare implementations against each other
+// rather than predict the ESP32's; heap figures count every operator new
+// made while a benchmark is measuring.
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <FS.h>
+#include "Trace.h"
+
+// Bytes handed out by operator new (all of the program's C++ allocations)
+struct HeapMeter {
+  size_t current;        // Live bytes
+  size_t peak;           // Most live bytes since reset()
+  uint32_t allocations;  // Since reset()
+
+  // Start measuring from what is live now
+  void reset() {
+    peak = current;
+    allocations = 0;
+  }
+
+  // Peak above `base` (the live bytes before the code being measured)
+  size_t peakAbove(size_t base) const { return peak - base; }
+};
+
+extern HeapMeter heapMeter;
+
+// Monotonic microseconds, 64-bit
+uint64_t benchMicros();
+
+// What the benchmarks take from the command line
+struct BenchmarkInput {
+  TraceSource* trace;      // --csv, --bin or the synthetic trace (--days)
+  uint32_t logIntervalMs;  // --interval
+  fs::FS& fs;              // --fs, for benchmarks that write log segments
+};
+
+int runJsonBenchmark();
+int runCodecBenchmark(BenchmarkInput& input);
+int runAccuracyBenchmark();
+
+// Run the named benchmark, returns the process exit code
+int runBenchmark(const char* name, BenchmarkInput& input);
+
+#endif
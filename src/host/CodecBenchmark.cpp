@@ -0,0 +1,208 @@
+// Log compression: delta coding throughput and ratio on a battery trace
+// Replays the trace (--csv, --bin or the synthetic one) through the
+// analytics step to get the points the firmware would log, then:
+//
+//   codec        PointDeltaEncoder/Decoder over every point in memory, a
+//                fresh coder per segment as on flash, repeated for at least
+//                BENCH_CODEC_MIN_MS
+//   segment log  the same points appended to a DeltaSegmentLog in the --fs
+//                directory (one file append per point, as the persistence
+//                task does), then decoded back with forEach() and with a
+//                Reader going through every index the log holds
+//
+// Throughput is in points and in packed (PackedPoint) bytes per second.
+// Every decode is checked against the points that went in.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+#include "Benchmark.h"
+#include "HostHal.h"
+#include "Trace.h"
+#include "Analytics.h"
+#include "DeltaCodec.h"
+#include "DeltaSegmentLog.h"
+
+#define BENCH_CODEC_MIN_MS 200
+#define BENCH_CODEC_DIR "/bench"
+
+// Keeps the points the history would persist
+class PointCapture : public HistorySink {
+public:
+  std::vector<PackedPoint> points;
+
+  void savePoint(const PackedPoint& point) override { points.push_back(point); }
+  void saveAnchor(const TimeAnchor&) override {}
+  void saveHour(const RollupPoint&) override {}
+  void saveDay(const RollupPoint&) override {}
+};
+
+// SOC saves are of no interest here
+class DiscardSoc : public AnalyticsSink {
+public:
+  void saveSoc(bool) override {}
+};
+
+static bool samePoint(const PackedPoint& a, const PackedPoint& b) {
+  return a.voltage == b.voltage && a.current == b.current && a.soc == b.soc;
+}
+
+// Replay the trace as the simulator does and keep the logged points
+static void capturePoints(TraceSource& trace, uint32_t logIntervalMs, std::vector<PackedPoint>& points) {
+  VirtualClock clock;
+  TimeBase timeBase(clock);
+  SocTracker socTracker(DEFAULT_CAPACITY_AH, PEUKERT_EXPONENT, FULL_VOLTAGE_THRESHOLD, FULL_DETECTION_TIME);
+  BatteryHistory* history = new BatteryHistory();
+  SampleRing<256>* ring = new SampleRing<256>();
+  PointCapture capture;
+  DiscardSoc discard;
+  Analytics analytics(clock, timeBase, socTracker, *history, discard);
+  history->setSink(&capture);
+  analytics.begin(logIntervalMs);
+
+  TraceSample sample;
+  bool first = true;
+  uint32_t previousMs = 0;
+  while (trace.next(sample)) {
+    if (!first) clock.advanceMs(sample.timeMs - previousMs);
+    first = false;
+    previousMs = sample.timeMs;
+    Sample published = {clock.micros(), sample.voltage, sample.current};
+    ring->push(published);
+    analytics.step(*ring, logIntervalMs);
+  }
+  points.swap(capture.points);
+  delete ring;
+  delete history;
+}
+
+static void printRate(const char* what, uint64_t points, uint64_t us) {
+  char line[128];
+  double seconds = max((uint64_t)1, us) / 1e6;
+  snprintf(line, sizeof(line), "  %-22s %9.2f Mpoints/s  %8.1f MB/s packed  (%.1f ns/point)",
+           what, points / seconds / 1e6, points * sizeof(PackedPoint) / seconds / 1e6,
+           us * 1000.0 / max((uint64_t)1, points));
+  Serial.println(line);
+}
+
+// In-memory codec: encode and decode every point, segment by segment
+static bool benchCodec(const std::vector<PackedPoint>& points) {
+  std::vector<uint8_t> coded(points.size() * DELTA_POINT_MAX_BYTES);
+  std::vector<PackedPoint> decoded(points.size());
+  size_t codedLen = 0;
+  uint32_t runs = 0;
+  uint64_t start = benchMicros();
+  uint64_t encodeUs;
+  do {
+    PointDeltaEncoder encoder;
+    codedLen = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+      if (i % LOG_RECORDS_PER_SEGMENT == 0) encoder.reset();
+      codedLen += encoder.encode(points[i], &coded[codedLen]);
+    }
+    runs++;
+    encodeUs = benchMicros() - start;
+  } while (encodeUs < BENCH_CODEC_MIN_MS * 1000);
+
+  bool ok = true;
+  uint32_t decodeRuns = 0;
+  start = benchMicros();
+  uint64_t decodeUs;
+  do {
+    PointDeltaDecoder decoder;
+    size_t pos = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+      if (i % LOG_RECORDS_PER_SEGMENT == 0) decoder.reset();
+      size_t used = decoder.decode(&coded[pos], codedLen - pos, decoded[i]);
+      if (used == 0) {
+        ok = false;
+        break;
+      }
+      pos += used;
+    }
+    decodeRuns++;
+    decodeUs = benchMicros() - start;
+  } while (decodeUs < BENCH_CODEC_MIN_MS * 1000);
+
+  for (size_t i = 0; ok && i < points.size(); i++) {
+    ok = samePoint(points[i], decoded[i]);
+  }
+
+  Serial.print("Delta codec: ");
+  Serial.print((unsigned long)codedLen);
+  Serial.print(" bytes for ");
+  Serial.print((unsigned long)(points.size() * sizeof(PackedPoint)));
+  Serial.print(" packed, ratio ");
+  Serial.println((double)points.size() * sizeof(PackedPoint) / max((size_t)1, codedLen), 2);
+  printRate("encode", points.size() * runs, encodeUs);
+  printRate("decode", points.size() * decodeRuns, decodeUs);
+  if (!ok) Serial.println("  Decoded points differ");
+  return ok;
+}
+
+// The flash log: appends, a full forEach() and a Reader over every index
+static bool benchSegmentLog(fs::FS& fs, const std::vector<PackedPoint>& points) {
+  DeltaSegmentLog log(fs, BENCH_CODEC_DIR, LOG_RECORDS_PER_SEGMENT, RAW_LOG_SEGMENT_COUNT);
+  log.begin();
+  log.clear();
+
+  uint64_t start = benchMicros();
+  for (size_t i = 0; i < points.size(); i++) {
+    log.append(points[i]);
+  }
+  uint64_t appendUs = benchMicros() - start;
+
+  uint32_t held = log.recordCount() - log.oldestRecord();
+  bool ok = true;
+  uint32_t visited = 0;
+  start = benchMicros();
+  log.forEach([&](const PackedPoint& point, uint32_t index) {
+    if (!samePoint(point, points[index])) ok = false;
+    visited++;
+  });
+  uint64_t forEachUs = benchMicros() - start;
+
+  DeltaSegmentLog::Reader reader(log);
+  uint32_t read = 0;
+  start = benchMicros();
+  for (uint32_t index = log.oldestRecord(); index != log.recordCount(); index++) {
+    PackedPoint point;
+    if (!reader.read(index, point) || !samePoint(point, points[index])) {
+      ok = false;
+      break;
+    }
+    read++;
+  }
+  uint64_t readerUs = benchMicros() - start;
+  ok = ok && visited == held && read == held;
+
+  Serial.print("Segment log: ");
+  Serial.print(log.recordCount());
+  Serial.print(" appended, ");
+  Serial.print(visited);
+  Serial.print(" held in ");
+  Serial.print(log.getStats().flashBytes);
+  Serial.print(" flash bytes, ratio ");
+  Serial.println(log.compressionRatio(), 2);
+  printRate("append (file I/O)", points.size(), appendUs);
+  printRate("forEach decode", visited, forEachUs);
+  printRate("Reader, every index", read, readerUs);
+  if (!ok) Serial.println("  Decoded points differ");
+  log.clear();
+  return ok;
+}
+
+int runCodecBenchmark(BenchmarkInput& input) {
+  std::vector<PackedPoint> points;
+  capturePoints(*input.trace, input.logIntervalMs, points);
+  Serial.print("Points: ");
+  Serial.print((unsigned long)points.size());
+  Serial.print(" logged every ");
+  Serial.print(input.logIntervalMs / 60000);
+  Serial.println(" min");
+  if (points.empty()) return 1;
+
+  bool ok = benchCodec(points);
+  ok = benchSegmentLog(input.fs, points) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+// Directory-backed fs::FS for the native build
+// Paths are the absolute LittleFS paths the firmware uses ("/log/0.seg"),
+// resolved below a host directory given to begin().
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class File : public Print {
+private:
+  std::shared_ptr<FILE> handle;  // Copies share the handle, like on the device
+
+public:
+  File() {}
+  explicit File(FILE* file) : handle(file, fclose) {}
+
+  operator bool() const { return (bool)handle; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    return handle ? fwrite(buffer, 1, size, handle.get()) : 0;
+  }
+  size_t read(uint8_t* buffer, size_t size) {
+    return handle ? fread(buffer, 1, size, handle.get()) : 0;
+  }
+  int read() {
+    return handle ? fgetc(handle.get()) : -1;
+  }
+  bool seek(uint32_t position, SeekMode mode = SeekSet) {
+    int whence = mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END;
+    return handle && fseek(handle.get(), position, whence) == 0;
+  }
+  size_t position() const { return handle ? ftell(handle.get()) : 0; }
+  size_t size() const {
+    if (!handle) return 0;
+    long here = ftell(handle.get());
+    fseek(handle.get(), 0, SEEK_END);
+    long end = ftell(handle.get());
+    fseek(handle.get(), here, SEEK_SET);
+    return end;
+  }
+  int available() { return size() - position(); }
+  void flush() { if (handle) fflush(handle.get()); }
+  void close() { handle.reset(); }
+};
+
+class FS {
+private:
+  std::string root;
+
+  std::string hostPath(const char* path) const { return root + path; }
+
+public:
+  // Use `directory` (created if missing) as the root of the filesystem
+  bool begin(const char* directory) {
+    root = directory;
+    ::mkdir(root.c_str(), 0755);
+    struct stat st;
+    return stat(root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  }
+
+  File open(const char* path, const char* mode = "r") {
+    // LittleFS modes, binary on the host; "w"/"a" create the file
+    std::string hostMode = std::string(mode) + "b";
+    FILE* file = fopen(hostPath(path).c_str(), hostMode.c_str());
+    return file ? File(file) : File();
+  }
+  File open(const String& path, const char* mode = "r") { return open(path.c_str(), mode); }
+
+  bool exists(const char* path) {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+  }
+  bool exists(const String& path) { return exists(path.c_str()); }
+
+  bool remove(const char* path) { return ::remove(hostPath(path).c_str()) == 0; }
+  bool remove(const String& path) { return remove(path.c_str()); }
+
+  bool rename(const char* from, const char* to) {
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+  }
+
+  bool mkdir(const char* path) { return ::mkdir(hostPath(path).c_str(), 0755) == 0; }
+  bool mkdir(const String& path) { return mkdir(path.c_str()); }
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif
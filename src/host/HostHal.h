@@ -0,0 +1,79 @@
+// Host implementations of the hardware interfaces (Hal.h)
+// Everything is driven by the caller, so a run is repeatable and can cover
+// days of battery time in a fraction of a second.
+
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include <stdint.h>
+#include "Hal.h"
+
+// Virtual time: only moves when advanced, by any amount at once, so a run
+// can fast-forward months. Kept in 64 bits; the Clock counters wrap like
+// the ESP32's.
+class VirtualClock : public Clock {
+private:
+  uint64_t nowUs;
+
+public:
+  explicit VirtualClock(uint64_t startUs = 0) : nowUs(startUs) {}
+
+  void advance(uint64_t us) { nowUs += us; }
+  void advanceMs(uint64_t ms) { nowUs += ms * 1000; }
+  uint64_t elapsedUs() const { return nowUs; }
+
+  uint32_t millis() override { return (uint32_t)(nowUs / 1000); }
+  uint32_t micros() override { return (uint32_t)nowUs; }
+  uint64_t micros64() override { return nowUs; }
+};
+
+// Returns whatever reading it was last given
+class FakeSensor : public BatterySensor {
+private:
+  SensorReading reading;
+
+public:
+  uint32_t reads;
+
+  FakeSensor() : reads(0) {
+    reading.voltage = 0;
+    reading.current = 0;
+  }
+
+  void set(float voltage, float current) {
+    reading.voltage = voltage;
+    reading.current = current;
+  }
+
+  bool begin() override { return true; }
+  void configure(uint8_t, uint8_t, uint8_t) override {}
+  void acknowledge() override {}
+  SensorReading read() override {
+    reads++;
+    return reading;
+  }
+};
+
+// Keeps the last values shown
+class RecordingDisplay : public DisplayOutput {
+public:
+  uint8_t brightness;
+  float voltage;
+  float soc;
+  float current;
+  uint32_t updates;
+
+  RecordingDisplay() : brightness(100), voltage(0), soc(0), current(0), updates(0) {}
+
+  void setBrightness(uint8_t percent) override { brightness = percent; }
+
+  bool show(float v, float s, float i) override {
+    voltage = v;
+    soc = s;
+    current = i;
+    updates++;
+    return true;
+  }
+};
+
+#endif
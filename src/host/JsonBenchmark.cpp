@@ -0,0 +1,210 @@
+// /data JSON: streamed records against the String the endpoint used to build
+// Fills a history with two weeks of synthetic points, then produces the raw
+// and hourly documents both ways:
+//
+//   string  the old getDataJSON()/getRollupJSON(): the whole document is
+//           concatenated into one String before the first byte can be sent
+//   stream  JsonArrayStream, read a chunk at a time the way the async web
+//           server pulls a chunked response
+//
+// For each it reports the peak heap, the time to the first byte and the
+// time for the whole document, averaged over BENCH_JSON_RUNS runs. Both use
+// the same prefix and suffix so the documents can be checked byte for byte.
+// Heap the web server allocates either way (its send buffer, and on the
+// device the copy of the String it keeps) is not included.
+
+#include <Arduino.h>
+#include "Benchmark.h"
+#include "Trace.h"
+#include "Analytics.h"
+#include "JsonStream.h"
+#include "HistoryJson.h"
+
+#define BENCH_JSON_RUNS 100
+#define BENCH_JSON_DAYS 15       // Fills the raw ring and the hourly tier
+#define BENCH_JSON_CHUNK 1460    // About one TCP segment, what the server asks for at a time
+#define BENCH_JSON_DOCUMENT_MAX 65536  // Room for the streamed copy, reserved before measuring
+
+// What one way of producing a document cost
+struct JsonCost {
+  size_t peakHeap;
+  uint32_t allocations;
+  uint64_t firstByteUs;
+  uint64_t totalUs;
+  size_t bytes;
+};
+
+// The pre-streaming getDataJSON() and getRollupJSON(), reading records
+// through the same calls as the stream so both documents hold the same ones
+
+// Every raw point, oldest first
+static String buildRawString(const BatteryHistory& history) {
+  String json = "{\"res\":\"raw\",\"data\":[";
+  bool first = true;
+  for (uint32_t sequence = history.rawOldest(); sequence != history.rawSequence(); sequence++) {
+    DataPoint point;
+    if (!history.getPoint(sequence, point)) continue;
+    if (!first) json += ",";
+    first = false;
+    json += "{";
+    json += "\"t\":" + String(point.timestamp) + ",";
+    json += "\"v\":" + String(point.voltage, 1) + ",";
+    json += "\"c\":" + String(point.current, 1) + ",";
+    json += "\"s\":" + String(point.soc, 1);
+    json += "}";
+  }
+  json += "]}";
+  return json;
+}
+
+// Every hour of the hourly tier
+static String buildHourlyString(const BatteryHistory& history) {
+  String json = "{\"res\":\"hour\",\"data\":[";
+  bool first = true;
+  const HistoryRing<RollupPoint, HOURLY_POINTS>& hourly = history.hourly();
+  for (uint32_t sequence = hourly.oldestSequence(); sequence != hourly.sequence(); sequence++) {
+    RollupPoint point;
+    if (!hourly.get(sequence, point)) continue;
+    if (!first) json += ",";
+    first = false;
+    json += "{";
+    json += "\"t\":" + String(point.timestamp) + ",";
+    json += "\"v\":" + String(point.voltageMean, 1) + ",";
+    json += "\"vl\":" + String(point.voltageMin, 1) + ",";
+    json += "\"vh\":" + String(point.voltageMax, 1) + ",";
+    json += "\"c\":" + String(point.currentMean, 1) + ",";
+    json += "\"cl\":" + String(point.currentMin, 1) + ",";
+    json += "\"ch\":" + String(point.currentMax, 1) + ",";
+    json += "\"s\":" + String(point.socMean, 1) + ",";
+    json += "\"sl\":" + String(point.socMin, 1) + ",";
+    json += "\"sh\":" + String(point.socMax, 1);
+    json += "}";
+  }
+  json += "]}";
+  return json;
+}
+
+static size_t formatRaw(char* out, size_t size, uint32_t sequence, void* context) {
+  DataPoint point;
+  if (!((const BatteryHistory*)context)->getPoint(sequence, point)) return 0;
+  return formatPointJson(out, size, point);
+}
+
+static size_t formatHourly(char* out, size_t size, uint32_t sequence, void* context) {
+  RollupPoint point;
+  if (!((const BatteryHistory*)context)->hourly().get(sequence, point)) return 0;
+  return formatRollupJson(out, size, point);
+}
+
+// Build the String, then hand it out a chunk at a time
+static JsonCost measureString(String (*build)(const BatteryHistory&), const BatteryHistory& history,
+                              std::string& document) {
+  JsonCost cost;
+  uint8_t chunk[BENCH_JSON_CHUNK];
+  size_t base = heapMeter.current;
+  heapMeter.reset();
+  uint64_t start = benchMicros();
+  {
+    String json = build(history);
+    cost.firstByteUs = benchMicros() - start;
+    for (size_t sent = 0; sent < json.length(); sent += BENCH_JSON_CHUNK) {
+      size_t n = min((size_t)BENCH_JSON_CHUNK, json.length() - sent);
+      memcpy(chunk, json.c_str() + sent, n);
+    }
+    cost.totalUs = benchMicros() - start;
+    cost.bytes = json.length();
+    cost.peakHeap = heapMeter.peakAbove(base);
+    cost.allocations = heapMeter.allocations;
+    document = json.c_str();  // After the measurement
+  }
+  return cost;
+}
+
+// Stream the document the way sendHistory() does: one allocation for the
+// stream state, then chunks until it is done
+static JsonCost measureStream(const char* prefix, JsonArrayStream::RecordFormatter formatter,
+                              const BatteryHistory& history, uint32_t first, uint32_t end,
+                              std::string& document) {
+  JsonCost cost;
+  uint8_t chunk[BENCH_JSON_CHUNK];
+  document.clear();
+  document.reserve(BENCH_JSON_DOCUMENT_MAX);
+  size_t base = heapMeter.current;
+  heapMeter.reset();
+  uint64_t start = benchMicros();
+  JsonArrayStream* stream = new JsonArrayStream(prefix, "]}", formatter, (void*)&history, first, end);
+  size_t n = stream->read(chunk, sizeof(chunk));
+  cost.firstByteUs = benchMicros() - start;
+  cost.bytes = 0;
+  while (n > 0) {
+    cost.bytes += n;
+    document.append((const char*)chunk, n);  // Reserved, does not allocate
+    n = stream->read(chunk, sizeof(chunk));
+  }
+  cost.totalUs = benchMicros() - start;
+  cost.peakHeap = heapMeter.peakAbove(base);
+  cost.allocations = heapMeter.allocations;
+  delete stream;
+  return cost;
+}
+
+static void addCost(JsonCost& sum, const JsonCost& run) {
+  sum.peakHeap = max(sum.peakHeap, run.peakHeap);
+  sum.allocations = run.allocations;
+  sum.firstByteUs += run.firstByteUs;
+  sum.totalUs += run.totalUs;
+  sum.bytes = run.bytes;
+}
+
+static void printCost(const char* name, const JsonCost& cost) {
+  char line[160];
+  snprintf(line, sizeof(line), "  %-7s %7lu bytes  peak heap %7lu B in %4lu allocations  first byte %7.1f us  total %7.1f us",
+           name, (unsigned long)cost.bytes, (unsigned long)cost.peakHeap, (unsigned long)cost.allocations,
+           (double)cost.firstByteUs / BENCH_JSON_RUNS, (double)cost.totalUs / BENCH_JSON_RUNS);
+  Serial.println(line);
+}
+
+// Both ways for one document, false if they disagree
+static bool compareJson(const char* title, String (*build)(const BatteryHistory&), const char* prefix,
+                        JsonArrayStream::RecordFormatter formatter, const BatteryHistory& history,
+                        uint32_t first, uint32_t end) {
+  JsonCost stringCost = {0, 0, 0, 0, 0};
+  JsonCost streamCost = {0, 0, 0, 0, 0};
+  std::string stringDocument;
+  std::string streamDocument;
+  for (int run = 0; run < BENCH_JSON_RUNS; run++) {
+    addCost(stringCost, measureString(build, history, stringDocument));
+    addCost(streamCost, measureStream(prefix, formatter, history, first, end, streamDocument));
+  }
+
+  Serial.println(title);
+  printCost("string", stringCost);
+  printCost("stream", streamCost);
+  if (stringDocument != streamDocument) {
+    Serial.println("  Documents differ");
+    return false;
+  }
+  return true;
+}
+
+int runJsonBenchmark() {
+  BatteryHistory* history = new BatteryHistory();
+  SyntheticTrace trace(BENCH_JSON_DAYS, DEFAULT_LOG_INTERVAL_MINUTES * 60000, DEFAULT_CAPACITY_AH, 100.0);
+  TraceSample sample;
+  while (trace.next(sample)) {
+    DataPoint point;
+    point.timestamp = sample.timeMs / 60000;
+    point.voltage = sample.voltage;
+    point.current = sample.current;
+    point.soc = sample.referenceSoc;
+    history->log(point, DEFAULT_LOG_INTERVAL_MINUTES);
+  }
+
+  bool same = compareJson("Raw points (/data?res=raw)", buildRawString, "{\"res\":\"raw\",\"data\":[",
+                          formatRaw, *history, history->rawOldest(), history->rawSequence());
+  same = compareJson("Hourly tier (/data?res=hour)", buildHourlyString, "{\"res\":\"hour\",\"data\":[",
+                     formatHourly, *history, history->hourly().oldestSequence(),
+                     history->hourly().sequence()) && same;
+  delete history;
+  return same ? 0 : 1;
+}
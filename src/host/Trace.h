@@ -0,0 +1,136 @@
+// Voltage/current traces for the simulator
+// A trace is a sequence of timestamped INA226 readings, replayed in
+// virtual time. Sources:
+//
+//   CSV     time_s,voltage,current[,soc]  one sample per line; lines that
+//           do not start with a number (headers, # comments) are skipped.
+//           The optional soc column is a reference SOC to compare against.
+//   Binary  packed little-endian TraceRecord, no header (e.g. dumped from
+//           the sample ring)
+//   Synthetic  a house battery with an overnight load and solar charging,
+//           carrying its own true SOC as the reference
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <Arduino.h>
+
+struct TraceSample {
+  uint32_t timeMs;      // Since the start of the trace, may wrap
+  float voltage;        // V
+  float current;        // A, positive = charging
+  float referenceSoc;   // %, NAN if the trace has none
+};
+
+struct __attribute__((packed)) TraceRecord {
+  uint32_t timeMs;
+  float voltage;
+  float current;
+};
+
+class TraceSource {
+public:
+  virtual ~TraceSource() {}
+  // Next sample, false at the end of the trace
+  virtual bool next(TraceSample& sample) = 0;
+};
+
+class CsvTrace : public TraceSource {
+private:
+  FILE* file;
+
+public:
+  explicit CsvTrace(FILE* input) : file(input) {}
+
+  bool next(TraceSample& sample) override {
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+      double seconds;
+      float soc;
+      int fields = sscanf(line, "%lf,%f,%f,%f", &seconds, &sample.voltage, &sample.current, &soc);
+      if (fields < 3) continue;
+      sample.timeMs = (uint32_t)(seconds * 1000.0 + 0.5);
+      sample.referenceSoc = fields == 4 ? soc : NAN;
+      return true;
+    }
+    return false;
+  }
+};
+
+class BinaryTrace : public TraceSource {
+private:
+  FILE* file;
+
+public:
+  explicit BinaryTrace(FILE* input) : file(input) {}
+
+  bool next(TraceSample& sample) override {
+    TraceRecord record;
+    if (fread(&record, sizeof(record), 1, file) != 1) return false;
+    sample.timeMs = record.timeMs;
+    sample.voltage = record.voltage;
+    sample.current = record.current;
+    sample.referenceSoc = NAN;
+    return true;
+  }
+};
+
+// The battery is integrated without a Peukert correction and the load is
+// smooth, so the difference from the reference SOC is mostly the monitor's
+// Peukert correction; --bench accuracy measures integration error
+class SyntheticTrace : public TraceSource {
+private:
+  uint32_t intervalMs;
+  uint64_t endMs;
+  uint64_t nowMs;
+  float capacityAh;
+  float ampHours;
+
+  // A 6 A load, plus solar from 07:00 to 19:00 that tapers off as the
+  // battery fills
+  float currentAt(uint32_t minuteOfDay, float soc) const {
+    float current = -6.0;
+    if (minuteOfDay >= 7 * 60 && minuteOfDay < 19 * 60) {
+      float sun = sin(M_PI * (minuteOfDay - 7 * 60) / (12 * 60.0));
+      float solar = 40.0 * sun;
+      float acceptance = (100.0 - soc) * 2.0 + 0.5;  // Absorption: the battery takes less near full
+      current += min(solar, acceptance + 6.0f);
+    }
+    return current;
+  }
+
+  // Rough lead acid terminal voltage for a SOC and current
+  static float voltageAt(float soc, float current) {
+    float voltage = 11.9 + 0.013 * soc;
+    if (current > 0) {
+      voltage += 0.6 + 0.02 * current;
+    } else {
+      voltage += 0.01 * current;
+    }
+    return voltage;
+  }
+
+public:
+  SyntheticTrace(uint32_t days, uint32_t sampleIntervalMs, float capacity, float initialSoc)
+    : intervalMs(sampleIntervalMs), endMs((uint64_t)days * 24 * 3600000), nowMs(0),
+      capacityAh(capacity), ampHours(capacity * initialSoc / 100.0) {}
+
+  bool next(TraceSample& sample) override {
+    if (nowMs >= endMs) return false;
+    float soc = ampHours / capacityAh * 100.0;
+    sample.timeMs = (uint32_t)nowMs;  // Wraps like millis()
+    sample.current = currentAt((nowMs / 60000) % (24 * 60), soc);
+    sample.voltage = voltageAt(soc, sample.current);
+    sample.referenceSoc = soc;
+
+    ampHours += sample.current * intervalMs / 3600000.0;
+    ampHours = max(0.0f, min(capacityAh, ampHours));
+    nowMs += intervalMs;
+    return true;
+  }
+};
+
+#endif
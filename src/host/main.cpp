@@ -0,0 +1,323 @@
+// Native build: trace replay simulator
+// Replays a voltage/current trace (Trace.h) through the firmware's analytics
+// step (Analytics.h) in virtual time: every sample advances a virtual clock
+// to its timestamp and goes into a sample ring, then the step integrates it
+// and updates the SOC and logs on the firmware's schedule. SOC saves go
+// through the same PersistSchedule as on the device, so the save count is
+// the number of coalesced flash writes. Log segments go to a host
+// directory, so a week of operation runs in seconds.
+//
+//   pio run -e native && .pio/build/native/program [options]
+//
+//   --csv FILE        replay a CSV trace (time_s,voltage,current[,soc])
+//   --bin FILE        replay a binary trace (TraceRecord)
+//   --days N          synthetic trace of N days (default 3, if no file)
+//   --soc FILE        write the SOC curve (one row per SOC update)
+//   --log FILE        write the raw log as decoded from the flash segments
+//   --hourly FILE     write the hourly tier
+//   --fs DIR          directory for the log segments (default native-fs)
+//   --capacity AH     battery capacity (default 300)
+//   --initial-soc P   SOC at the start of the trace (default 100)
+//   --interval MIN    log interval in minutes (default 10)
+//   --wall-clock S    Unix time (seconds) at the start of the trace; log
+//                     rows then carry absolute times
+//   --bench NAME      run a benchmark on the trace instead (Benchmark.h):
+//                     json, codec, accuracy
+
+#include <Arduino.h>
+#include <FS.h>
+#include "HostHal.h"
+#include "Trace.h"
+#include "Benchmark.h"
+#include "SampleRing.h"
+#include "DeltaSegmentLog.h"
+#include "SegmentLog.h"
+#include "Analytics.h"
+
+#define SYNTHETIC_SAMPLE_MS 1000
+#define DEFAULT_DAYS 3
+#define SAMPLE_RING_SIZE 256  // The step drains it after every sample
+
+FS hostFS;
+DeltaSegmentLog dataSegments(hostFS, LOG_SEGMENT_DIR, LOG_RECORDS_PER_SEGMENT, RAW_LOG_SEGMENT_COUNT);
+SegmentLog anchorSegments(hostFS, ANCHOR_SEGMENT_DIR, sizeof(TimeAnchor),
+                          MAX_TIME_ANCHORS / (LOG_SEGMENT_COUNT - 1), LOG_SEGMENT_COUNT);
+SegmentLog hourlySegments(hostFS, HOURLY_SEGMENT_DIR, sizeof(RollupPoint),
+                          HOURLY_POINTS / (LOG_SEGMENT_COUNT - 1), LOG_SEGMENT_COUNT);
+SegmentLog dailySegments(hostFS, DAILY_SEGMENT_DIR, sizeof(RollupPoint),
+                         DAILY_POINTS / (LOG_SEGMENT_COUNT - 1), LOG_SEGMENT_COUNT);
+
+// Writes records straight to the log segments (no persistence task here)
+class FlashSink : public HistorySink {
+public:
+  void savePoint(const PackedPoint& point) override { dataSegments.append(point); }
+  void saveAnchor(const TimeAnchor& anchor) override { anchorSegments.append(&anchor); }
+  void saveHour(const RollupPoint& hour) override { hourlySegments.append(&hour); }
+  void saveDay(const RollupPoint& day) override { dailySegments.append(&day); }
+};
+
+// Run statistics
+uint32_t fullDetections = 0;
+uint32_t socMarks = 0;
+uint32_t socWrites = 0;
+uint32_t socUpdates = 0;
+float maxSocError = 0;
+float latestReferenceSoc = NAN;
+FILE* socOut = NULL;
+
+VirtualClock simClock;
+PersistSchedule persistSchedule;
+
+// Counts what the analytics step does and writes the SOC curve
+class SimAnalyticsSink : public AnalyticsSink {
+public:
+  void socUpdated(const Sample& latest, bool becameFull) override;
+  void saveSoc(bool urgent) override {
+    socMarks++;
+    persistSchedule.mark(PERSIST_SOC, urgent);
+  }
+};
+
+TimeBase timeBase(simClock);
+FakeSensor sensor;
+RecordingDisplay display;
+SampleRing<SAMPLE_RING_SIZE> sampleRing;
+SocTracker socTracker(DEFAULT_CAPACITY_AH, PEUKERT_EXPONENT, FULL_VOLTAGE_THRESHOLD, FULL_DETECTION_TIME);
+BatteryHistory history;
+FlashSink flashSink;
+SimAnalyticsSink analyticsSink;
+Analytics analytics(simClock, timeBase, socTracker, history, analyticsSink);
+uint32_t logIntervalMs = DEFAULT_LOG_INTERVAL_MINUTES * 60000;
+
+void SimAnalyticsSink::socUpdated(const Sample& latest, bool becameFull) {
+  socUpdates++;
+  if (becameFull) fullDetections++;
+
+  float soc = socTracker.getSoc();
+  if (!isnan(latestReferenceSoc)) {
+    maxSocError = max(maxSocError, (float)fabs(soc - latestReferenceSoc));
+  }
+  if (socOut) {
+    fprintf(socOut, "%.1f,%.3f,%.3f,%.2f,", simClock.millis() / 1000.0, latest.voltage, latest.current, soc);
+    if (!isnan(latestReferenceSoc)) fprintf(socOut, "%.2f", latestReferenceSoc);
+    fprintf(socOut, "\n");
+  }
+}
+
+// One trace sample: the sampling task's read, the analytics task's step,
+// then the persistence task's flush (it wakes at least every second)
+void replaySample(const TraceSample& sample) {
+  sensor.set(sample.voltage, sample.current);
+  SensorReading reading = sensor.read();
+  Sample published = {simClock.micros(), reading.voltage, reading.current};
+  sampleRing.push(published);
+  latestReferenceSoc = sample.referenceSoc;
+  display.show(reading.voltage, socTracker.getSoc(), reading.current);
+
+  analytics.step(sampleRing, logIntervalMs);
+  if (persistSchedule.take(simClock.millis(), false) & PERSIST_SOC) {
+    socWrites++;
+  }
+}
+
+FILE* openOutput(const char* path) {
+  if (!path) return NULL;
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    Serial.print("Cannot write ");
+    Serial.println(path);
+  }
+  return file;
+}
+
+// The raw log as stored on flash, dated by the time anchors (and the
+// epoch from the segment headers, if there is one)
+void writeLog(FILE* out) {
+  fprintf(out, "index,minute,unix,voltage,current,soc\n");
+  uint32_t epoch = dataSegments.getUserData();
+  dataSegments.forEach([out, epoch](const PackedPoint& packed, uint32_t index) {
+    DataPoint point = unpackPoint(packed, history.timestampOf(index));
+    fprintf(out, "%u,%u,", index, point.timestamp);
+    if (epoch != 0) fprintf(out, "%llu", (unsigned long long)(epoch + (uint64_t)point.timestamp) * 60);
+    fprintf(out, ",%.2f,%.2f,%.1f\n", point.voltage, point.current, point.soc);
+  });
+}
+
+void writeHourly(FILE* out) {
+  fprintf(out, "hour,voltage,current,soc,socMin,socMax\n");
+  for (size_t i = 0; i < history.hourly().size(); i++) {
+    const RollupPoint& hour = history.hourly().at(i);
+    fprintf(out, "%u,%.2f,%.2f,%.1f,%.1f,%.1f\n", hour.timestamp / 60, hour.voltageMean,
+            hour.currentMean, hour.socMean, hour.socMin, hour.socMax);
+  }
+}
+
+// The unit tests (pio test -e native) build src/host for the Arduino shim
+// and bring their own main()
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char** argv) {
+  const char* csvPath = NULL;
+  const char* binPath = NULL;
+  const char* socPath = NULL;
+  const char* logPath = NULL;
+  const char* hourlyPath = NULL;
+  const char* dir = "native-fs";
+  int days = DEFAULT_DAYS;
+  float capacity = DEFAULT_CAPACITY_AH;
+  float initialSoc = 100.0;
+  uint32_t wallClock = 0;
+  const char* bench = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    String option = argv[i];
+    if (i + 1 >= argc) {
+      Serial.print("Missing value for ");
+      Serial.println(argv[i]);
+      return 2;
+    }
+    const char* value = argv[++i];
+    if (option == "--csv") csvPath = value;
+    else if (option == "--bin") binPath = value;
+    else if (option == "--days") days = atoi(value);
+    else if (option == "--soc") socPath = value;
+    else if (option == "--log") logPath = value;
+    else if (option == "--hourly") hourlyPath = value;
+    else if (option == "--fs") dir = value;
+    else if (option == "--capacity") capacity = atof(value);
+    else if (option == "--initial-soc") initialSoc = atof(value);
+    else if (option == "--interval") logIntervalMs = atoi(value) * 60000;
+    else if (option == "--wall-clock") wallClock = strtoul(value, NULL, 10);
+    else if (option == "--bench") bench = value;
+    else {
+      Serial.print("Unknown option ");
+      Serial.println(argv[i - 1]);
+      return 2;
+    }
+  }
+
+  FILE* traceFile = NULL;
+  TraceSource* trace;
+  if (csvPath || binPath) {
+    traceFile = fopen(csvPath ? csvPath : binPath, csvPath ? "r" : "rb");
+    if (!traceFile) {
+      Serial.println("Cannot open trace");
+      return 1;
+    }
+    if (csvPath) trace = new CsvTrace(traceFile);
+    else trace = new BinaryTrace(traceFile);
+  } else {
+    trace = new SyntheticTrace(days, SYNTHETIC_SAMPLE_MS, capacity, initialSoc);
+  }
+
+  if (!hostFS.begin(dir)) {
+    Serial.println("Cannot use filesystem directory");
+    return 1;
+  }
+  if (bench) {
+    BenchmarkInput input = {trace, logIntervalMs, hostFS};
+    int result = runBenchmark(bench, input);
+    if (traceFile) fclose(traceFile);
+    delete trace;
+    return result;
+  }
+  // Start from empty logs every run
+  dataSegments.begin();
+  anchorSegments.begin();
+  hourlySegments.begin();
+  dailySegments.begin();
+  dataSegments.clear();
+  anchorSegments.clear();
+  hourlySegments.clear();
+  dailySegments.clear();
+  history.setSink(&flashSink);
+  sensor.begin();
+  if (wallClock != 0) {
+    if (timeBase.setWallClock(wallClock) != WALL_CLOCK_SET) {
+      Serial.println("Wall clock must be between 2020 and 2100");
+      return 2;
+    }
+  }
+  dataSegments.setUserData(timeBase.getEpoch());
+
+  socTracker.setCapacity(capacity);
+  SocState state = socTracker.getState();
+  state.socPercentage = initialSoc;
+  state.ampHoursRemaining = capacity * initialSoc / 100.0;
+  socTracker.setState(state);
+  analytics.begin(logIntervalMs);
+
+  socOut = openOutput(socPath);
+  if (socOut) fprintf(socOut, "time_s,voltage,current,soc,ref_soc\n");
+
+  // Virtual time follows the trace timestamps
+  uint32_t startMs = millis();
+  TraceSample sample;
+  uint32_t samples = 0;
+  uint32_t previousMs = 0;
+  while (trace->next(sample)) {
+    if (samples > 0) simClock.advanceMs(sample.timeMs - previousMs);
+    previousMs = sample.timeMs;
+    replaySample(sample);
+    samples++;
+  }
+
+  uint32_t runMs = max(1UL, millis() - startMs);
+  if (socOut) fclose(socOut);
+  if (traceFile) fclose(traceFile);
+  delete trace;
+
+  FILE* out = openOutput(logPath);
+  if (out) {
+    writeLog(out);
+    fclose(out);
+  }
+  out = openOutput(hourlyPath);
+  if (out) {
+    writeHourly(out);
+    fclose(out);
+  }
+
+  Serial.print("Samples: ");
+  Serial.print(samples);
+  Serial.print(" over ");
+  Serial.print(simClock.elapsedUs() / 3600e6, 1);
+  Serial.print(" h in ");
+  Serial.print(runMs);
+  Serial.print(" ms (");
+  Serial.print((unsigned long)(simClock.elapsedUs() / 1000 / runMs));
+  Serial.println("x real time)");
+  Serial.print("SOC: ");
+  Serial.print(socTracker.getSoc(), 1);
+  Serial.print("% (");
+  Serial.print(socTracker.getAmpHoursRemaining(), 1);
+  Serial.println(" Ah)");
+  if (!isnan(latestReferenceSoc)) {
+    Serial.print("Reference SOC: ");
+    Serial.print(latestReferenceSoc, 1);
+    Serial.print("%, largest difference ");
+    Serial.print(maxSocError, 1);
+    Serial.println("%");
+  }
+  Serial.print("SOC updates: ");
+  Serial.print(socUpdates);
+  Serial.print(", marked for saving: ");
+  Serial.print(socMarks);
+  Serial.print(", flash writes: ");
+  Serial.print(socWrites);
+  Serial.print(", full detections: ");
+  Serial.println(fullDetections);
+  Serial.print("Raw points: ");
+  Serial.print(history.rawSize());
+  Serial.print(", hours: ");
+  Serial.print(history.hourly().size());
+  Serial.print(", days: ");
+  Serial.println(history.daily().size());
+  Serial.print("Log records: ");
+  Serial.print(dataSegments.recordCount());
+  Serial.print(", flash bytes ");
+  Serial.print(dataSegments.getStats().flashBytes);
+  Serial.print(", compression ");
+  Serial.println(dataSegments.compressionRatio(), 2);
+  return 0;
+}
+#endif
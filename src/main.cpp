@@ -3,8 +3,27 @@
 #include <WiFi.h>
 #include <ESPAsyncWebServer.h>
 #include <LittleFS.h>
+#include <esp_timer.h>
+#include <esp_system.h>
 #include "INA226.h"
 #include "CharlieplexDisplay.h"
+#include "SampleRing.h"
+#include "CoulombCounter.h"
+#include "SegmentLog.h"
+#include "DeltaSegmentLog.h"
+#include "RetentionTiers.h"
+#include "JsonStream.h"
+#include "HistoryJson.h"
+#include "HistoryFormat.h"
+#include "SocStore.h"
+#include "PackedPoint.h"
+#include "HistoryStore.h"
+#include "SocTracker.h"
+#include "Esp32Hal.h"
+#include "TimeBase.h"
+#include "Analytics.h"
+#include <memory>
+#include <atomic>
 
 // INA226 I2C address (default is 0x40, verify with your module)
 #define INA226_ADDRESS 0x40
@@ -16,100 +35,541 @@
 // Shunt resistor value
 #define SHUNT_RESISTOR 0.0015  // 0.0015 Ohm (1.5 milliohm)
 
-// Battery specifications (configurable via web UI)
-float batteryCapacityAh = 300.0;  // Default 300Ah, user configurable
-unsigned long logIntervalMs = 10 * 60 * 1000;  // Default 10 minutes, user configurable
-
-#define PEUKERT_EXPONENT 1.1       // Peukert exponent for lead acid (typically 1.05-1.4)
-// C20_RATE calculated as batteryCapacityAh / 20.0 at runtime
-#define FULL_VOLTAGE_THRESHOLD 13.8  // Voltage threshold for "full" detection
+// Battery, SOC and logging settings shared with the native build: Analytics.h
+#define MAX_SHUNT_CURRENT 50.0     // A, for the INA226 calibration
 #define FULL_CURRENT_THRESHOLD 1.0   // Current below this (in A) indicates full when voltage high
-#define FULL_DETECTION_TIME 60000    // Must meet criteria for 60 seconds
+unsigned long logIntervalMs = DEFAULT_LOG_INTERVAL_MINUTES * 60000UL;  // User configurable
 
-// SOC calculation settings
-#define SOC_CALC_INTERVAL_MS 10000  // Calculate SOC every 10 seconds
+// Scheduling clock (systemClock): SOC updates, logging, roll-ups, saves and
+// the display timers. Above 1 all of them run that many times faster than
+// real time, for soak testing on the bench. Task periods stay real, so past
+// ~100x SOC is updated once per analytics tick rather than every 10 s.
+#define CLOCK_SPEEDUP 1
 
 // WiFi AP settings
 const char* ssid = "f-power";
 const char* password = "";  // No password
 
-// Data logging settings
-#define MAX_DATA_POINTS 288  // 48 hours at 10-minute intervals (48*6)
+// Data logging settings (history sizes and log segments: Analytics.h)
+#define LEGACY_DATA_POINTS 288  // Points in a datalog.bin or 16-byte segment log
+
+// INA226 sampling task
+#define SAMPLE_RATE_HZ 100           // Polling rate when not using the alert pin (chip defaults allow ~450)
+#define SAMPLE_RING_SIZE 2048        // Samples kept for consumers (~0.57 s at the fast profile, ~4.5 s at the default)
+#define FASTEST_SAMPLE_US 280        // Shortest profile conversion time ("fast": 1 x (140 + 140 us))
+#define SAMPLING_TASK_CORE 0         // Keep I2C off the core running the other tasks and the display
+#define SAMPLING_TASK_PRIORITY 5
+#define SAMPLING_TASK_STACK 4096
+
+// INA226 conversion-ready alert
+// true: ALERT pin interrupt wakes the sampling task for every conversion
+// false: poll at SAMPLE_RATE_HZ
+#define USE_CONVERSION_READY_ALERT true
+#define INA226_ALERT_PIN 26          // ALERT is open drain, active low
+#define ALERT_TIMEOUT_MS 100         // Margin on top of the conversion time before a plain read
+#define I2C_CLOCK_HZ 400000          // Fast mode, needed to keep up with the fast profile
+
+// Application tasks. Acquisition shares core 0 with WiFi; everything else
+// runs on core 1, where the display timer interrupt also lives. Higher
+// numbers preempt lower ones.
+#define ANALYTICS_TASK_CORE 1        // SOC, full detection, logging and roll-ups
+#define ANALYTICS_TASK_PRIORITY 3
+#define ANALYTICS_TASK_STACK 4096
+#define ANALYTICS_PERIOD_MS 100
+#define PERSISTENCE_TASK_CORE 1      // Flash writes only
+#define PERSISTENCE_TASK_PRIORITY 1
+#define PERSISTENCE_TASK_STACK 6144
+#define PERSIST_QUEUE_LENGTH 16      // Records waiting for flash
+#define PERSIST_QUEUE_WAIT_MS 100    // Longest a producer waits for queue space
+#define PERSIST_WAKE_MS 1000         // Persistence task drains the queue at least this often
+#define POWER_FAIL_VOLTAGE 10.5      // Bus voltage below which pending state is flushed at once
+#define DISPLAY_TASK_CORE 1          // Display buffer updates (and the scan without DISPLAY_USE_TIMER)
+#define DISPLAY_TASK_PRIORITY 4
+#define DISPLAY_TASK_STACK 3072
+#define DISPLAY_UPDATE_MS 500
+#define WEB_TASK_CORE 1              // Live push; requests are served by the async_tcp task
+#define WEB_TASK_PRIORITY 2
+#define WEB_TASK_STACK 4096
+
+// INA226 acquisition profiles (averaging and conversion times)
+// A new result is ready every average * (bus + shunt conversion time)
+struct AcquisitionProfile {
+  const char* name;
+  uint8_t average;           // INA226_x_SAMPLE(S)
+  uint8_t busConversion;     // INA226_x_us
+  uint8_t shuntConversion;   // INA226_x_us
+};
+
+const AcquisitionProfile acquisitionProfiles[] = {
+  {"fast",     INA226_1_SAMPLE,    INA226_140_us,  INA226_140_us},   // ~0.3 ms, catches transients
+  {"default",  INA226_1_SAMPLE,    INA226_1100_us, INA226_1100_us},  // ~2.2 ms, chip power-on defaults
+  {"balanced", INA226_16_SAMPLES,  INA226_588_us,  INA226_588_us},   // ~19 ms
+  {"lownoise", INA226_128_SAMPLES, INA226_1100_us, INA226_1100_us}   // ~280 ms, heavily averaged
+};
+#define ACQUISITION_PROFILE_COUNT (sizeof(acquisitionProfiles) / sizeof(acquisitionProfiles[0]))
+
+// The analytics task drains the ring every ANALYTICS_PERIOD_MS; at the
+// fastest profile it must hold at least two periods' worth of samples, or
+// the coulomb counter loses charge whenever the task is held up
+static_assert((uint64_t)SAMPLE_RING_SIZE * FASTEST_SAMPLE_US >= 2ULL * ANALYTICS_PERIOD_MS * 1000,
+              "SAMPLE_RING_SIZE too small for FASTEST_SAMPLE_US");
+#define DEFAULT_ACQUISITION_PROFILE 1
+uint8_t acquisitionProfile = DEFAULT_ACQUISITION_PROFILE;  // User configurable
+uint8_t displayBrightness = 100;  // Percent, user configurable
+
+// Register field values to their meaning
+const uint16_t inaAverageCounts[] = {1, 4, 16, 64, 128, 256, 512, 1024};
+const uint16_t inaConversionTimesUs[] = {140, 204, 332, 588, 1100, 2100, 4200, 8300};
 
-// Display refresh rate
-#define REFRESH_INTERVAL_MS 0  // 0 = fastest, increase if needed (1, 2, 5, 10 ms)
+// Live readings pushed to dashboards over Server-Sent Events (/events)
+#define LIVE_PUSH_INTERVAL_MS 1000   // One snapshot per second to every client
 
-// Data structure
-struct DataPoint {
-  unsigned long timestamp;  // Minutes since boot
+// Display task refresh period (only used when DISPLAY_USE_TIMER is false)
+#define REFRESH_INTERVAL_MS 0  // 0 = every tick, increase if needed (1, 2, 5, 10 ms)
+
+// Raw log points (packed, dated by time anchors) and their roll-ups
+BatteryHistory history;
+uint32_t dataLoadUs = 0;  // Decoding the flash log at boot
+
+// Raw point layout before PackedPoint, for importing old logs
+struct LegacyDataPoint {
+  uint32_t timestamp;
   float voltage;
   float current;
-  float soc;  // State of charge percentage
+  float soc;
+};
+
+// History tier served by /data
+enum HistoryTier {
+  TIER_RAW,
+  TIER_HOURLY,
+  TIER_DAILY,
+  TIER_LOG      // Raw points decoded from the flash log, only on request
+};
+
+// Records selected by one history request: every step-th sequence number
+// in [first, end)
+struct HistoryQuery {
+  HistoryTier tier;
+  uint32_t first;
+  uint32_t end;
+  uint32_t step;
+  uint32_t scanned;   // Records looked at to find first and end
+  bool windowed;      // from, to or max_points given
+};
+
+// State of one streamed /data response, freed together with the response.
+// The formatters get it as their context.
+struct HistoryResponse {
+  HistoryQuery query;
+  DeltaSegmentLog::Reader reader;  // TIER_LOG only
+  uint32_t visited;                // RAM records looked up by the formatters
+  JsonArrayStream stream;
+  
+  HistoryResponse(const HistoryQuery& q, const char* prefix, JsonArrayStream::RecordFormatter formatter,
+                  DeltaSegmentLog& log)
+    : query(q), reader(log), visited(0), stream(prefix, "]}", formatter, this, q.first, q.end) {
+    stream.setStep(q.step);
+  }
 };
 
-DataPoint dataLog[MAX_DATA_POINTS];
-int dataIndex = 0;
-int dataCount = 0;
-unsigned long lastLogTime = 0;
-unsigned long bootTime = 0;
+// State of one /data.bin response
+struct BinaryHistoryResponse {
+  HistoryBinHeader header;
+  HistoryTier tier;
+  uint32_t step;
+};
+
+// A record for one of the flash logs, queued for the persistence task
+enum PersistLog {
+  PERSIST_RAW,
+  PERSIST_ANCHOR,
+  PERSIST_HOURLY,
+  PERSIST_DAILY
+};
+
+struct PersistRecord {
+  PersistLog log;
+  union {
+    PackedPoint point;    // PERSIST_RAW
+    TimeAnchor anchor;    // PERSIST_ANCHOR
+    RollupPoint rollup;   // PERSIST_HOURLY, PERSIST_DAILY
+  };
+};
 
-// SOC tracking variables
-float socPercentage = 100.0;  // Current state of charge percentage
-float ampHoursRemaining = 300.0;  // Amp-hours remaining (will be set to batteryCapacityAh)
-unsigned long lastSocCalcTime = 0;
-unsigned long fullDetectionStartTime = 0;
-bool batteryWasFull = false;
+// Small state files written behind by the persistence task: PERSIST_* (Analytics.h)
+struct PersistStats {
+  volatile uint32_t marks;           // markDirty() calls
+  volatile uint32_t socWrites;
+  volatile uint32_t settingsWrites;
+  volatile uint32_t records;         // Log records written
+  volatile uint32_t dropped;         // Log records lost to a full queue
+};
+
+// Application tasks, see /debug/tasks
+enum AppTask {
+  TASK_ACQUISITION,
+  TASK_ANALYTICS,
+  TASK_PERSISTENCE,
+  TASK_DISPLAY,
+  TASK_WEB,
+  TASK_COUNT
+};
+
+// CPU use is measured by the tasks themselves (time between waking up and
+// blocking again), FreeRTOS run-time stats are not enabled in this core
+struct AppTaskInfo {
+  const char* name;
+  TaskHandle_t handle;
+  volatile uint32_t busyUs;     // Wraps, only differences are used
+  uint32_t reportedBusyUs;      // busyUs at the previous /debug/tasks
+};
 
-// Charlieplex display
-CharlieplexDisplay display;
+// SOC tracking (updated by the analytics task)
+SocTracker socTracker(DEFAULT_CAPACITY_AH, PEUKERT_EXPONENT, FULL_VOLTAGE_THRESHOLD, FULL_DETECTION_TIME);
+portMUX_TYPE socMux = portMUX_INITIALIZER_UNLOCKED;  // Guards copies in and out of it, never an update
 
+// Hardware
+ArduinoClock arduinoClock;
+AcceleratedClock acceleratedClock(arduinoClock, CLOCK_SPEEDUP);
+Clock& systemClock = CLOCK_SPEEDUP > 1 ? (Clock&)acceleratedClock : (Clock&)arduinoClock;
+TimeBase timeBase(systemClock);  // Record timestamps (minutes), wall clock once a browser has sent it
+CharlieplexDisplay display(systemClock);
+CharlieplexOutput displayOutput(display);
 INA226 ina(INA226_ADDRESS);
+Ina226Sensor sensor(ina, MAX_SHUNT_CURRENT, SHUNT_RESISTOR);
+SampleRing<SAMPLE_RING_SIZE> sampleRing;
+TaskHandle_t samplingTaskHandle = NULL;
+
+// Acquisition counters (written by the sampling task only)
+struct AcquisitionStats {
+  volatile uint32_t totalSamples;
+  volatile uint32_t missedConversions;
+  volatile uint32_t alertTimeouts;
+  volatile float samplesPerSec;
+};
+AcquisitionStats acquisitionStats = {0, 0, 0, 0.0};
+
+QueueHandle_t persistQueue = NULL;
+SemaphoreHandle_t persistMutex = NULL;  // Held while writing, and by readers of the flash logs
+PersistSchedule persistSchedule;  // Dirty state files and when they are due
+PersistStats persistStats = {0, 0, 0, 0, 0};
+AppTaskInfo appTasks[TASK_COUNT] = {
+  {"acquisition", NULL, 0, 0},
+  {"analytics", NULL, 0, 0},
+  {"persistence", NULL, 0, 0},
+  {"display", NULL, 0, 0},
+  {"web", NULL, 0, 0}
+};
+int64_t tasksReportedUs = 0;
+
 AsyncWebServer server(80);
+AsyncEventSource events("/events");
+uint32_t liveEventId = 0;
 
 // File paths for data storage
-const char* dataFilePath = "/datalog.bin";
-const char* socFilePath = "/soc.bin";
+const char* dataFilePath = "/datalog.bin";  // Pre-segment format, imported once on boot
+const char* socFilePath = "/soc.bin";  // Pre-slot format, read once if no slot is valid
 const char* settingsFilePath = "/settings.bin";
 
+// SOC state, two alternating CRC-checked slots
+SocStore socStore(LittleFS, "/soc0.bin", "/soc1.bin");
+
+// Data log segments (the wall-clock epoch is kept in each segment header)
+DeltaSegmentLog dataSegments(LittleFS, LOG_SEGMENT_DIR, LOG_RECORDS_PER_SEGMENT, RAW_LOG_SEGMENT_COUNT);
+SegmentLog anchorSegments(LittleFS, ANCHOR_SEGMENT_DIR, sizeof(TimeAnchor),
+                          MAX_TIME_ANCHORS / (LOG_SEGMENT_COUNT - 1), LOG_SEGMENT_COUNT);
+SegmentLog hourlySegments(LittleFS, HOURLY_SEGMENT_DIR, sizeof(RollupPoint),
+                          HOURLY_POINTS / (LOG_SEGMENT_COUNT - 1), LOG_SEGMENT_COUNT);
+SegmentLog dailySegments(LittleFS, DAILY_SEGMENT_DIR, sizeof(RollupPoint),
+                         DAILY_POINTS / (LOG_SEGMENT_COUNT - 1), LOG_SEGMENT_COUNT);
+
 // Forward declarations
-void saveData();
+void saveDataPoint(const PackedPoint& point);
+void saveTimeAnchor(const TimeAnchor& anchor);
+void saveRollup(PersistLog log, const RollupPoint& rollup);
+void persistRecord(const PersistRecord& record);
+void writeRecord(const PersistRecord& record);
+void markDirty(uint32_t items, bool urgent);
+void flushPersistence(bool all);
+void lockLogs();
+void unlockLogs();
+void saveEpoch();
+void persistShutdown();
 bool loadData();
+bool importLegacyData();
+bool importLegacySegments();
+void loadRollups();
+HistoryTier selectHistoryTier(const String& resolution, uint32_t rangeMinutes);
+size_t formatRawRecord(char* out, size_t size, uint32_t sequence, void* context);
+size_t formatLogRecord(char* out, size_t size, uint32_t sequence, void* context);
+size_t formatRollupRecord(char* out, size_t size, uint32_t sequence, void* context);
+uint32_t findHistoryTime(HistoryTier tier, uint32_t first, uint32_t end, uint32_t minute, uint32_t& scanned);
+HistoryQuery makeHistoryQuery(HistoryTier tier, uint32_t rangeMinutes, uint32_t from, uint32_t to, uint32_t since);
+HistoryQuery parseHistoryRequest(AsyncWebServerRequest* request);
+const char* historyTierName(HistoryTier tier);
+String historyETag(const HistoryQuery& query);
+bool sendIfNotModified(AsyncWebServerRequest* request, const String& etag);
+bool getHistoryTimestamp(HistoryTier tier, uint32_t sequence, uint32_t& timestamp);
+bool copyHistoryRecord(HistoryTier tier, uint32_t sequence, uint8_t* out);
+void sendHistory(AsyncWebServerRequest* request, const HistoryQuery& query);
+void sendHistoryBinary(AsyncWebServerRequest* request, const HistoryQuery& query);
 void saveSoc();
 bool loadSoc();
 void saveSettings();
 bool loadSettings();
-void logData();
-void calculateSoc();
-void checkBatteryFull(float voltage, float current);
-String getDataJSON();
-
-// Save data to flash
-void saveData() {
-  File file = LittleFS.open(dataFilePath, "w");
-  if (!file) {
-    Serial.println("Failed to open file for writing");
+void samplingTask(void* parameter);
+void onConversionReady();
+uint32_t profileConversionUs(uint8_t profile);
+void applyAcquisitionProfile(uint8_t profile);
+int findAcquisitionProfile(const String& name);
+Sample getLatestSample();
+String getCurrentJSON();
+void pushLiveReading();
+void startAppTasks();
+void countBusy(AppTask task, uint32_t startUs);
+void analyticsTask(void* parameter);
+void persistenceTask(void* parameter);
+void displayTask(void* parameter);
+void webTask(void* parameter);
+
+// Queues the history's records for the persistence task
+class PersistSink : public HistorySink {
+public:
+  void savePoint(const PackedPoint& point) override { saveDataPoint(point); }
+  void saveAnchor(const TimeAnchor& anchor) override { saveTimeAnchor(anchor); }
+  void saveHour(const RollupPoint& hour) override { saveRollup(PERSIST_HOURLY, hour); }
+  void saveDay(const RollupPoint& day) override { saveRollup(PERSIST_DAILY, day); }
+};
+PersistSink persistSink;
+
+// Locks the SOC for the web task and hands saves to the persistence task
+class AppAnalyticsSink : public AnalyticsSink {
+public:
+  void lockSoc() override { portENTER_CRITICAL(&socMux); }
+  void unlockSoc() override { portEXIT_CRITICAL(&socMux); }
+
+  void socUpdated(const Sample& latest, bool becameFull) override {
+    if (becameFull) Serial.println("Battery detected as FULL - SOC reset to 100%");
+  }
+
+  void saveSoc(bool urgent) override { markDirty(PERSIST_SOC, urgent); }
+
+  void logged(const DataPoint& point) override {
+    Serial.print("Data logged - V:");
+    Serial.print(point.voltage, 2);
+    Serial.print("V I:");
+    Serial.print(point.current, 2);
+    Serial.print("A SOC:");
+    Serial.print(point.soc, 1);
+    Serial.println("%");
+  }
+};
+AppAnalyticsSink analyticsSink;
+
+// Integration, SOC and logging (run by the analytics task)
+Analytics analytics(systemClock, timeBase, socTracker, history, analyticsSink);
+
+// Append one data point to the flash log
+void saveDataPoint(const PackedPoint& point) {
+  PersistRecord record;
+  record.log = PERSIST_RAW;
+  record.point = point;
+  persistRecord(record);
+}
+
+// Append a time anchor to the flash log (queued ahead of its point)
+void saveTimeAnchor(const TimeAnchor& anchor) {
+  PersistRecord record;
+  record.log = PERSIST_ANCHOR;
+  record.anchor = anchor;
+  persistRecord(record);
+}
+
+// Append a finished hour or day to its tier's flash log
+void saveRollup(PersistLog log, const RollupPoint& rollup) {
+  PersistRecord record;
+  record.log = log;
+  record.rollup = rollup;
+  persistRecord(record);
+}
+
+// Hand a record to the persistence task (written straight away during
+// setup(), before the task exists)
+void persistRecord(const PersistRecord& record) {
+  if (persistQueue == NULL) {
+    writeRecord(record);
     return;
   }
+  if (xQueueSend(persistQueue, &record, pdMS_TO_TICKS(PERSIST_QUEUE_WAIT_MS)) != pdTRUE) {
+    persistStats.dropped++;
+    Serial.println("Persistence queue full - record dropped");
+  }
+}
+
+// Note that SOC and/or settings changed. Nothing is written here: the
+// persistence task saves the current values later, so repeated changes
+// cost one write. Urgent changes are saved at its next wake-up, routine
+// SOC updates within PERSIST_SOC_INTERVAL_MS.
+void markDirty(uint32_t items, bool urgent) {
+  persistStats.marks++;
+  persistSchedule.mark(items, urgent);
+  if (urgent) {
+    if (appTasks[TASK_PERSISTENCE].handle != NULL) {
+      xTaskNotifyGive(appTasks[TASK_PERSISTENCE].handle);
+    }
+  }
+}
+
+// Write queued log records, then the dirty state files that are due (all
+// of them if `all`). Called by the persistence task and on shutdown.
+void flushPersistence(bool all) {
+  if (xSemaphoreTake(persistMutex, pdMS_TO_TICKS(PERSIST_WAKE_MS)) != pdTRUE) return;
+  
+  PersistRecord record;
+  while (xQueueReceive(persistQueue, &record, 0) == pdTRUE) {
+    writeRecord(record);
+    persistStats.records++;
+  }
   
-  // Write metadata
-  file.write((uint8_t*)&dataIndex, sizeof(dataIndex));
-  file.write((uint8_t*)&dataCount, sizeof(dataCount));
-  file.write((uint8_t*)&bootTime, sizeof(bootTime));
-  
-  // Write data array
-  file.write((uint8_t*)dataLog, sizeof(dataLog));
+  uint32_t items = persistSchedule.take(systemClock.millis(), all);
+  if (items & PERSIST_SETTINGS) {
+    saveSettings();
+    persistStats.settingsWrites++;
+  }
+  if (items & PERSIST_EPOCH) {
+    saveEpoch();
+  }
+  if (items & PERSIST_SOC) {
+    saveSoc();
+    persistStats.socWrites++;
+  }
   
-  file.close();
-  Serial.println("Data saved to flash");
+  xSemaphoreGive(persistMutex);
+}
+
+// The flash logs are only written by the persistence task, under
+// persistMutex. Readers on other tasks (the web server) hold it while they
+// look at a log's index or read its segments, so a rotation cannot recycle
+// a segment under them. Before startAppTasks() setup() is the only task.
+void lockLogs() {
+  if (persistMutex != NULL) xSemaphoreTake(persistMutex, portMAX_DELAY);
+}
+
+void unlockLogs() {
+  if (persistMutex != NULL) xSemaphoreGive(persistMutex);
+}
+
+// Stamp the wall-clock epoch into the log headers. The raw log starts a
+// new segment so the epoch is on flash at once; the others pick it up with
+// their next segment.
+void saveEpoch() {
+  uint32_t epoch = timeBase.getEpoch();
+  dataSegments.setUserData(epoch);
+  anchorSegments.setUserData(epoch);
+  hourlySegments.setUserData(epoch);
+  dailySegments.setUserData(epoch);
+  if (!dataSegments.rotate()) {
+    Serial.println("Failed to save wall-clock epoch");
+  }
+}
+
+// Registered with esp_register_shutdown_handler(): runs on esp_restart()
+void persistShutdown() {
+  if (persistMutex != NULL) flushPersistence(true);
+}
+
+// Append a record to its flash log. Only the persistence task (or setup())
+// writes the logs.
+void writeRecord(const PersistRecord& record) {
+  bool saved = false;
+  switch (record.log) {
+    case PERSIST_RAW:
+      saved = dataSegments.append(record.point);
+      break;
+    case PERSIST_ANCHOR:
+      saved = anchorSegments.append(&record.anchor);
+      break;
+    case PERSIST_HOURLY:
+      saved = hourlySegments.append(&record.rollup);
+      break;
+    case PERSIST_DAILY:
+      saved = dailySegments.append(&record.rollup);
+      break;
+  }
+  if (!saved) {
+    Serial.println("Failed to save data point");
+  }
 }
 
-// Load data from flash
+// Rebuild the RAM ring and time anchors from the flash log segments
 bool loadData() {
-  if (!LittleFS.exists(dataFilePath)) {
+  anchorSegments.begin();
+  bool found = dataSegments.begin();
+  if (!found) {
+    found = importLegacySegments();
+  }
+  if (!found && LittleFS.exists(dataFilePath)) {
+    found = importLegacyData();
+  }
+  if (!found) {
+    anchorSegments.clear();  // Nothing left for them to date
     Serial.println("No saved data found");
     return false;
   }
   
+  history.clearRaw();
+  anchorSegments.forEach([](const uint8_t* record, uint32_t index) {
+    TimeAnchor anchor;
+    memcpy(&anchor, record, sizeof(anchor));
+    history.addAnchor(anchor);
+  });
+  uint32_t loadStart = micros();
+  dataSegments.forEach([](const PackedPoint& point, uint32_t index) {
+    history.addPacked(point, index);  // Keep ring slots aligned with log record numbers
+  });
+  dataLoadUs = micros() - loadStart;
+  
+  Serial.print("Data loaded from flash: ");
+  Serial.print(history.rawSize());
+  Serial.println(" data points");
+  
+  return history.rawSize() > 0;
+}
+
+// Load the hourly and daily tiers and rebuild the partially filled buckets
+// from the finer tier, finishing any bucket lost to a power cut
+void loadRollups() {
+  hourlySegments.begin();
+  dailySegments.begin();
+  hourlySegments.setUserData(timeBase.getEpoch());
+  dailySegments.setUserData(timeBase.getEpoch());
+  
+  // Number the entries like the log records, so sequence numbers (and the
+  // ETags built from them) keep increasing across reboots
+  history.hourly().clear(hourlySegments.recordCount());
+  hourlySegments.forEach([](const uint8_t* record, uint32_t index) {
+    RollupPoint hour;
+    memcpy(&hour, record, sizeof(hour));
+    history.hourly().push(hour, index);
+  });
+  history.daily().clear(dailySegments.recordCount());
+  dailySegments.forEach([](const uint8_t* record, uint32_t index) {
+    RollupPoint day;
+    memcpy(&day, record, sizeof(day));
+    history.daily().push(day, index);
+  });
+  history.resumeRollups();
+  
+  Serial.print("Rollups loaded: ");
+  Serial.print(history.hourly().size());
+  Serial.print(" hourly, ");
+  Serial.print(history.daily().size());
+  Serial.println(" daily");
+}
+
+// Convert a datalog.bin from the old whole-array format into segments
+bool importLegacyData() {
   File file = LittleFS.open(dataFilePath, "r");
   if (!file) {
     Serial.println("Failed to open file for reading");
@@ -117,38 +577,113 @@ bool loadData() {
   }
   
   // Read metadata
-  file.read((uint8_t*)&dataIndex, sizeof(dataIndex));
-  file.read((uint8_t*)&dataCount, sizeof(dataCount));
-  file.read((uint8_t*)&bootTime, sizeof(bootTime));
+  int32_t legacyIndex = 0;
+  int32_t legacyCount = 0;
+  uint32_t legacyBootTime = 0;  // millis() at first boot, not a wall clock
+  file.read((uint8_t*)&legacyIndex, sizeof(legacyIndex));
+  file.read((uint8_t*)&legacyCount, sizeof(legacyCount));
+  file.read((uint8_t*)&legacyBootTime, sizeof(legacyBootTime));
+  size_t arrayStart = file.position();
+  if (legacyCount < 0 || legacyCount > LEGACY_DATA_POINTS) legacyCount = 0;
+  
+  // Append oldest first, one point at a time
+  anchorSegments.clear();
+  history.clearRaw();
+  int oldest = (legacyCount < LEGACY_DATA_POINTS) ? 0 : legacyIndex % LEGACY_DATA_POINTS;
+  int imported = 0;
+  for (int i = 0; i < legacyCount; i++) {
+    LegacyDataPoint legacy;
+    file.seek(arrayStart + ((oldest + i) % LEGACY_DATA_POINTS) * sizeof(legacy));
+    if (file.read((uint8_t*)&legacy, sizeof(legacy)) != sizeof(legacy)) break;
+    DataPoint point = {legacy.timestamp, legacy.voltage, legacy.current, legacy.soc};
+    history.store(point, logIntervalMs / 60000, true);
+    imported++;
+  }
+  file.close();
+  LittleFS.remove(dataFilePath);
   
-  // Read data array
-  file.read((uint8_t*)dataLog, sizeof(dataLog));
+  Serial.print("Imported legacy data log: ");
+  Serial.print(imported);
+  Serial.println(" data points");
   
-  file.close();
+  return imported > 0;
+}
+
+// Convert segments of fixed-size records (16-byte points with their own
+// timestamps, or uncoded packed points) into delta-coded ones. Both logs
+// use the same directory, so the old points are read into the RAM ring
+// before their segments are removed and the ring is written back.
+bool importLegacySegments() {
+  SegmentLog legacySegments(LittleFS, LOG_SEGMENT_DIR, sizeof(LegacyDataPoint),
+                            LEGACY_DATA_POINTS / (LOG_SEGMENT_COUNT - 1), LOG_SEGMENT_COUNT);
+  SegmentLog packedSegments(LittleFS, LOG_SEGMENT_DIR, sizeof(PackedPoint),
+                            LOG_RECORDS_PER_SEGMENT, LOG_SEGMENT_COUNT);
+  history.clearRaw();
+  
+  if (legacySegments.begin()) {
+    // Anchored afresh from the stored timestamps, numbered from 0
+    legacySegments.forEach([](const uint8_t* record, uint32_t index) {
+      LegacyDataPoint legacy;
+      memcpy(&legacy, record, sizeof(legacy));
+      DataPoint point = {legacy.timestamp, legacy.voltage, legacy.current, legacy.soc};
+      history.store(point, logIntervalMs / 60000, false);
+    });
+    legacySegments.clear();
+    anchorSegments.clear();
+    for (size_t i = 0; i < history.anchors().size(); i++) {
+      saveTimeAnchor(history.anchors().at(i));
+    }
+  } else if (packedSegments.begin()) {
+    // Same numbering, so the stored anchors still apply
+    packedSegments.forEach([](const uint8_t* record, uint32_t index) {
+      PackedPoint point;
+      memcpy(&point, record, sizeof(point));
+      history.addPacked(point, index);
+    });
+    packedSegments.clear();
+  } else {
+    return false;
+  }
   
-  Serial.print("Data loaded from flash: ");
-  Serial.print(dataCount);
+  dataSegments.setFirstRecord(history.rawOldest());
+  for (uint32_t sequence = history.rawOldest(); sequence != history.rawSequence(); sequence++) {
+    const PackedPoint* point = history.findPacked(sequence);
+    if (point) saveDataPoint(*point);
+  }
+  
+  Serial.print("Converted log segments: ");
+  Serial.print(history.rawSize());
   Serial.println(" data points");
   
-  return true;
+  return history.rawSize() > 0;
 }
 
 // Save SOC data to flash
 void saveSoc() {
-  File file = LittleFS.open(socFilePath, "w");
-  if (!file) {
-    Serial.println("Failed to open SOC file for writing");
-    return;
-  }
-  
-  file.write((uint8_t*)&socPercentage, sizeof(socPercentage));
-  file.write((uint8_t*)&ampHoursRemaining, sizeof(ampHoursRemaining));
+  portENTER_CRITICAL(&socMux);
+  SocState state = socTracker.getState();
+  portEXIT_CRITICAL(&socMux);
   
-  file.close();
+  if (!socStore.save(state)) {
+    Serial.println("Failed to save SOC");
+  }
 }
 
 // Load SOC data from flash
 bool loadSoc() {
+  SocState state;
+  if (socStore.load(state)) {
+    socTracker.setState(state);
+    
+    Serial.print("SOC loaded from flash: ");
+    Serial.print(state.socPercentage, 1);
+    Serial.print("% (save #");
+    Serial.print(socStore.getSequence());
+    Serial.println(")");
+    return true;
+  }
+  
+  // Older firmware kept two floats in soc.bin
   if (!LittleFS.exists(socFilePath)) {
     Serial.println("No saved SOC data found - starting at 100%");
     return false;
@@ -160,13 +695,18 @@ bool loadSoc() {
     return false;
   }
   
-  file.read((uint8_t*)&socPercentage, sizeof(socPercentage));
-  file.read((uint8_t*)&ampHoursRemaining, sizeof(ampHoursRemaining));
-  
+  state = socTracker.getState();
+  bool complete = file.read((uint8_t*)&state.socPercentage, sizeof(state.socPercentage)) == sizeof(state.socPercentage) &&
+                  file.read((uint8_t*)&state.ampHoursRemaining, sizeof(state.ampHoursRemaining)) == sizeof(state.ampHoursRemaining);
   file.close();
+  if (!complete) {
+    Serial.println("SOC file truncated - starting at 100%");
+    return false;
+  }
+  socTracker.setState(state);
   
-  Serial.print("SOC loaded from flash: ");
-  Serial.print(socPercentage, 1);
+  Serial.print("SOC loaded from legacy file: ");
+  Serial.print(state.socPercentage, 1);
   Serial.println("%");
   
   return true;
@@ -180,8 +720,11 @@ void saveSettings() {
     return;
   }
   
-  file.write((uint8_t*)&batteryCapacityAh, sizeof(batteryCapacityAh));
+  float capacityAh = socTracker.getCapacity();
+  file.write((uint8_t*)&capacityAh, sizeof(capacityAh));
   file.write((uint8_t*)&logIntervalMs, sizeof(logIntervalMs));
+  file.write((uint8_t*)&acquisitionProfile, sizeof(acquisitionProfile));
+  file.write((uint8_t*)&displayBrightness, sizeof(displayBrightness));
   
   file.close();
   Serial.println("Settings saved to flash");
@@ -200,136 +743,569 @@ bool loadSettings() {
     return false;
   }
   
-  file.read((uint8_t*)&batteryCapacityAh, sizeof(batteryCapacityAh));
+  float capacityAh = DEFAULT_CAPACITY_AH;
+  file.read((uint8_t*)&capacityAh, sizeof(capacityAh));
   file.read((uint8_t*)&logIntervalMs, sizeof(logIntervalMs));
+  socTracker.setCapacity(capacityAh);
+  
+  // Profile was added later - older settings files end before it
+  uint8_t savedProfile;
+  if (file.read(&savedProfile, sizeof(savedProfile)) == sizeof(savedProfile) &&
+      savedProfile < ACQUISITION_PROFILE_COUNT) {
+    acquisitionProfile = savedProfile;
+  }
+  uint8_t savedBrightness;
+  if (file.read(&savedBrightness, sizeof(savedBrightness)) == sizeof(savedBrightness) &&
+      savedBrightness <= 100) {
+    displayBrightness = savedBrightness;
+  }
   
   file.close();
   
   Serial.print("Settings loaded - Capacity: ");
-  Serial.print(batteryCapacityAh, 0);
+  Serial.print(capacityAh, 0);
   Serial.print("Ah, Log interval: ");
   Serial.print(logIntervalMs / 60000);
-  Serial.println(" minutes");
+  Serial.print(" minutes, Profile: ");
+  Serial.print(acquisitionProfiles[acquisitionProfile].name);
+  Serial.print(", Brightness: ");
+  Serial.print(displayBrightness);
+  Serial.println("%");
   
   return true;
 }
 
-// Calculate SOC based on current consumption/charging
-void calculateSoc() {
-  unsigned long currentTime = millis();
-  if (lastSocCalcTime == 0) {
-    lastSocCalcTime = currentTime;
-    return;
-  }
+// Time between results for a profile (microseconds)
+uint32_t profileConversionUs(uint8_t profile) {
+  const AcquisitionProfile& p = acquisitionProfiles[profile];
+  return (uint32_t)inaAverageCounts[p.average] *
+         (inaConversionTimesUs[p.busConversion] + inaConversionTimesUs[p.shuntConversion]);
+}
 
-  // Save SOC only when it changes significantly or periodically
-  static unsigned long lastSocSaveTime = 0;
-  static float lastSavedSoc = socPercentage;
-  
-  // Calculate time elapsed in hours
-  float hoursElapsed = (currentTime - lastSocCalcTime) / 3600000.0;
-  
-  // Read current
-  float current = ina.getCurrent_mA() / 1000.0;  // Convert to Amps
-  float voltage = ina.getBusVoltage();
-  
-  // Calculate amp-hours consumed/charged
-  float ahChange = current * hoursElapsed;
-  
-  // Apply Peukert correction when discharging
-  if (current < 0) {  // Discharging (negative current)
-    float dischargeCurrent = abs(current);
-    // Peukert correction factor: (I / C20)^(n-1)
-    float c20Rate = batteryCapacityAh / 20.0;
-    float peukertFactor = pow(dischargeCurrent / c20Rate, PEUKERT_EXPONENT - 1.0);
-    ahChange *= peukertFactor;  // Increases effective consumption at higher discharge rates
-  }
-  // When charging (positive current), no Peukert correction needed
-  
-  ampHoursRemaining += ahChange;
-  
-  // Clamp to battery capacity
-  if (ampHoursRemaining > batteryCapacityAh) {
-    ampHoursRemaining = batteryCapacityAh;
+// Program averaging and conversion times. Only call from setup() before
+// the sampling task starts, or from the sampling task itself.
+void applyAcquisitionProfile(uint8_t profile) {
+  const AcquisitionProfile& p = acquisitionProfiles[profile];
+  sensor.configure(p.average, p.busConversion, p.shuntConversion);
+}
+
+// Profile index by name, -1 if unknown
+int findAcquisitionProfile(const String& name) {
+  for (size_t i = 0; i < ACQUISITION_PROFILE_COUNT; i++) {
+    if (name == acquisitionProfiles[i].name) return i;
   }
-  if (ampHoursRemaining < 0) {
-    ampHoursRemaining = 0;
+  return -1;
+}
+
+// ALERT pin ISR: a fresh conversion is ready, wake the sampling task
+void IRAM_ATTR onConversionReady() {
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(samplingTaskHandle, &higherPriorityTaskWoken);
+  if (higherPriorityTaskWoken) {
+    portYIELD_FROM_ISR();
   }
-  
-  // Calculate percentage
-  socPercentage = (ampHoursRemaining / batteryCapacityAh) * 100.0;
-  
-  // Check if battery is full
-  checkBatteryFull(voltage, current);
-  
-  lastSocCalcTime = currentTime;
-  
-  // Save if SOC changed by >0.5% OR every 10 minutes
-  bool socChanged = abs(socPercentage - lastSavedSoc) > 0.5;
-  bool timeToSave = (currentTime - lastSocSaveTime >= 600000);  // 10 minutes
-  
-  if (socChanged || timeToSave) {
-    saveSoc();
-    lastSocSaveTime = currentTime;
-    lastSavedSoc = socPercentage;
-  }
-}
-
-// Check if battery is full and reset SOC to 100%
-void checkBatteryFull(float voltage, float current) {
-  // Calculate full current threshold as percentage of capacity
-  // Use C/200 rate (1% of capacity) as taper threshold
-  float fullCurrentThreshold = batteryCapacityAh / 100.0;
-
-  // Detect full battery: 
-  // 1. Voltage >= threshold
-  // 2. CHARGING (current > 0, not discharging)
-  // 3. Charge current has tapered below threshold
-  if (voltage >= FULL_VOLTAGE_THRESHOLD && 
-      current > 0 && 
-      current < fullCurrentThreshold) {
-    if (!batteryWasFull) {
-      // Start timing
-      if (fullDetectionStartTime == 0) {
-        fullDetectionStartTime = millis();
+}
+
+// Read the INA226 and publish into sampleRing. In alert mode each
+// conversion is read once, as soon as the chip signals it is ready;
+// otherwise the chip is polled at SAMPLE_RATE_HZ, or slower if the
+// profile's conversion time is longer.
+// This is the only place that talks to the sensor after setup().
+void samplingTask(void* parameter) {
+  uint8_t activeProfile = acquisitionProfile;
+  uint32_t conversionUs = profileConversionUs(activeProfile);
+  TickType_t period = max((TickType_t)1, pdMS_TO_TICKS(max(1000UL / SAMPLE_RATE_HZ, (unsigned long)conversionUs / 1000)));
+  TickType_t alertTimeout = pdMS_TO_TICKS(conversionUs / 1000 + ALERT_TIMEOUT_MS);
+  TickType_t lastWake = xTaskGetTickCount();
+  uint32_t lastReadUs = 0;
+  uint32_t windowStartUs = micros();
+  uint32_t windowSamples = 0;
+  uint32_t busyStart = micros();
+  
+  while (true) {
+    // Profile changed from /settings - reprogram the chip and retime
+    if (acquisitionProfile != activeProfile) {
+      activeProfile = acquisitionProfile;
+      applyAcquisitionProfile(activeProfile);
+      conversionUs = profileConversionUs(activeProfile);
+      period = max((TickType_t)1, pdMS_TO_TICKS(max(1000UL / SAMPLE_RATE_HZ, (unsigned long)conversionUs / 1000)));
+      alertTimeout = pdMS_TO_TICKS(conversionUs / 1000 + ALERT_TIMEOUT_MS);
+      lastReadUs = 0;  // Gap across the switch is not a missed conversion
+    }
+    
+    if (USE_CONVERSION_READY_ALERT) {
+      uint32_t notifications = ulTaskNotifyTake(pdTRUE, alertTimeout);
+      busyStart = micros();
+      if (notifications == 0) {
+        // No edge seen - read anyway so a stuck flag gets cleared
+        acquisitionStats.alertTimeouts++;
+      }
+      sensor.acknowledge();
+    } else {
+      vTaskDelayUntil(&lastWake, period);
+      busyStart = micros();
+    }
+    
+    // Conversion timing is measured in real time; the sample is stamped
+    // with the scheduling clock the coulomb counter integrates over
+    Sample sample;
+    uint32_t readUs = micros();
+    sample.timestampUs = systemClock.micros();
+    SensorReading reading = sensor.read();
+    sample.voltage = reading.voltage;
+    sample.current = reading.current;
+    sampleRing.push(sample);
+    
+    // While ALERT is held low by an unread conversion no new edge can occur,
+    // so conversions we were too late for only show up as a longer gap
+    if (USE_CONVERSION_READY_ALERT && lastReadUs != 0) {
+      uint32_t gapUs = readUs - lastReadUs;
+      uint32_t conversions = (gapUs + conversionUs / 2) / conversionUs;
+      if (conversions > 1) {
+        acquisitionStats.missedConversions += conversions - 1;
       }
-      
-      // Check if conditions held for required time
-      if (millis() - fullDetectionStartTime >= FULL_DETECTION_TIME) {
-        // Battery is full! Reset SOC
-        socPercentage = 100.0;
-        ampHoursRemaining = batteryCapacityAh;
-        batteryWasFull = true;
-        
-        Serial.println("Battery detected as FULL - SOC reset to 100%");
-        saveSoc();  // Save immediately
+    }
+    lastReadUs = readUs;
+    acquisitionStats.totalSamples++;
+    
+    // Achieved rate over one-second windows
+    windowSamples++;
+    uint32_t windowUs = readUs - windowStartUs;
+    if (windowUs >= 1000000) {
+      acquisitionStats.samplesPerSec = windowSamples * 1000000.0 / windowUs;
+      windowStartUs = readUs;
+      windowSamples = 0;
+    }
+    countBusy(TASK_ACQUISITION, busyStart);
+  }
+}
+
+// Add the time since startUs to a task's busy counter
+void countBusy(AppTask task, uint32_t startUs) {
+  appTasks[task].busyUs += micros() - startUs;
+}
+
+// SOC integration, full detection, logging and roll-ups. Flash writes are
+// queued for the persistence task.
+void analyticsTask(void* parameter) {
+  TickType_t lastWake = xTaskGetTickCount();
+  bool powerLow = false;
+  while (true) {
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(ANALYTICS_PERIOD_MS));
+    uint32_t busyStart = micros();
+    
+    // The monitor runs from the battery it measures: when the supply sags
+    // get pending SOC onto flash before the ESP32 browns out
+    Sample sample = getLatestSample();
+    if (sample.timestampUs != 0) {
+      bool low = sample.voltage < POWER_FAIL_VOLTAGE;
+      if (low && !powerLow) {
+        Serial.println("Supply voltage low - flushing state");
+        markDirty(PERSIST_SOC, true);
       }
+      powerLow = low;
     }
-  } else {
-    // Conditions not met, reset detection
-    fullDetectionStartTime = 0;
-    batteryWasFull = false;
+    
+    // Integrate every sample so short surges between SOC updates are
+    // counted, update SOC every 10 seconds, log at the configured interval
+    analytics.step(sampleRing, logIntervalMs);
+    countBusy(TASK_ANALYTICS, busyStart);
+  }
+}
+
+// Writes queued log records and dirty state files to flash, so a slow
+// LittleFS write only delays this task
+void persistenceTask(void* parameter) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PERSIST_WAKE_MS));
+    uint32_t busyStart = micros();
+    flushPersistence(false);
+    countBusy(TASK_PERSISTENCE, busyStart);
+  }
+}
+
+// Feeds the display with the latest reading. The multiplexing itself runs
+// from the display timer; without DISPLAY_USE_TIMER this task also scans.
+void displayTask(void* parameter) {
+  unsigned long lastUpdate = 0;
+  while (true) {
+    uint32_t busyStart = micros();
+    unsigned long currentTime = systemClock.millis();
+    if (lastUpdate == 0 || currentTime - lastUpdate >= DISPLAY_UPDATE_MS) {
+      Sample sample = getLatestSample();
+      displayOutput.show(sample.voltage, socTracker.getSoc(), sample.current);
+      lastUpdate = currentTime;
+    }
+    
+    if (DISPLAY_USE_TIMER) {
+      countBusy(TASK_DISPLAY, busyStart);
+      vTaskDelay(pdMS_TO_TICKS(DISPLAY_UPDATE_MS));
+    } else {
+      display.refresh();
+      countBusy(TASK_DISPLAY, busyStart);
+      vTaskDelay(max((TickType_t)1, pdMS_TO_TICKS(REFRESH_INTERVAL_MS)));
+    }
+  }
+}
+
+// Pushes live readings to dashboards connected to /events
+void webTask(void* parameter) {
+  TickType_t lastWake = xTaskGetTickCount();
+  while (true) {
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(LIVE_PUSH_INTERVAL_MS));
+    uint32_t busyStart = micros();
+    pushLiveReading();
+    countBusy(TASK_WEB, busyStart);
+  }
+}
+
+// Start everything except acquisition (started earlier in setup())
+void startAppTasks() {
+  persistQueue = xQueueCreate(PERSIST_QUEUE_LENGTH, sizeof(PersistRecord));
+  persistMutex = xSemaphoreCreateMutex();
+  esp_register_shutdown_handler(persistShutdown);
+  appTasks[TASK_ACQUISITION].handle = samplingTaskHandle;
+  xTaskCreatePinnedToCore(persistenceTask, "persistence", PERSISTENCE_TASK_STACK, NULL,
+                          PERSISTENCE_TASK_PRIORITY, &appTasks[TASK_PERSISTENCE].handle, PERSISTENCE_TASK_CORE);
+  xTaskCreatePinnedToCore(analyticsTask, "analytics", ANALYTICS_TASK_STACK, NULL,
+                          ANALYTICS_TASK_PRIORITY, &appTasks[TASK_ANALYTICS].handle, ANALYTICS_TASK_CORE);
+  xTaskCreatePinnedToCore(displayTask, "display", DISPLAY_TASK_STACK, NULL,
+                          DISPLAY_TASK_PRIORITY, &appTasks[TASK_DISPLAY].handle, DISPLAY_TASK_CORE);
+  xTaskCreatePinnedToCore(webTask, "web", WEB_TASK_STACK, NULL,
+                          WEB_TASK_PRIORITY, &appTasks[TASK_WEB].handle, WEB_TASK_CORE);
+  tasksReportedUs = esp_timer_get_time();
+}
+
+// Most recent reading from the sampling task (zeros before the first sample)
+Sample getLatestSample() {
+  Sample sample = {0, 0.0, 0.0};
+  sampleRing.latest(sample);
+  return sample;
+}
+
+// Pick the history tier for a /data request. An explicit resolution wins;
+// otherwise use the finest tier whose history covers the requested range
+// (0 = everything the raw log holds). If none covers it, as on a device
+// whose hourly and daily tiers are still filling, use the one that holds
+// the most history, the finer on a tie.
+HistoryTier selectHistoryTier(const String& resolution, uint32_t rangeMinutes) {
+  if (resolution == "raw") return TIER_RAW;
+  if (resolution == "hour") return TIER_HOURLY;
+  if (resolution == "day") return TIER_DAILY;
+  if (resolution == "log") return TIER_LOG;
+  
+  uint32_t rawSpan = history.rawSize() * (logIntervalMs / 60000);
+  uint32_t hourlySpan = history.hourly().size() * MINUTES_PER_HOUR;
+  uint32_t dailySpan = history.daily().size() * MINUTES_PER_DAY;
+  if (rangeMinutes <= rawSpan || rangeMinutes == 0) return TIER_RAW;
+  if (rangeMinutes <= hourlySpan) return TIER_HOURLY;
+  if (dailySpan > hourlySpan && dailySpan > rawSpan) return TIER_DAILY;
+  return hourlySpan > rawSpan ? TIER_HOURLY : TIER_RAW;
+}
+
+// Timestamp of a history record, false if it is not held (any more)
+bool getHistoryTimestamp(HistoryTier tier, uint32_t sequence, uint32_t& timestamp) {
+  if (tier == TIER_LOG) {
+    timestamp = history.timestampOf(sequence);
+    return true;
+  }
+  if (tier == TIER_RAW) {
+    DataPoint point;
+    if (!history.getPoint(sequence, point)) return false;
+    timestamp = point.timestamp;
+    return true;
+  }
+  RollupPoint point;
+  bool found = (tier == TIER_HOURLY) ? history.hourly().get(sequence, point) : history.daily().get(sequence, point);
+  if (!found) return false;
+  timestamp = point.timestamp;
+  return true;
+}
+
+// Copy a history record in its /data.bin layout, false if it is not held
+// (any more). Raw points are sent packed, with the anchor's timestamp.
+bool copyHistoryRecord(HistoryTier tier, uint32_t sequence, uint8_t* out) {
+  if (tier == TIER_RAW) {
+    PackedPoint point;
+    if (!history.getPacked(sequence, point)) return false;
+    HistoryPackedRecord record = {history.timestampOf(sequence), point.voltage, point.current, point.soc};
+    memcpy(out, &record, sizeof(record));
+    return true;
   }
+  RollupPoint point;
+  bool found = (tier == TIER_HOURLY) ? history.hourly().get(sequence, point) : history.daily().get(sequence, point);
+  if (found) memcpy(out, &point, sizeof(point));
+  return found;
+}
+
+// First sequence number of a tier in [first, end) whose record is at or
+// after `minute` (findFirstAtOrAfter(), HistoryStore.h)
+uint32_t findHistoryTime(HistoryTier tier, uint32_t first, uint32_t end, uint32_t minute, uint32_t& scanned) {
+  return findFirstAtOrAfter(first, end, minute, scanned, [tier](uint32_t sequence, uint32_t& timestamp) {
+    return getHistoryTimestamp(tier, sequence, timestamp);
+  });
 }
 
-// Generate JSON string of all data points
-String getDataJSON() {
-  String json = "{\"data\":[";
+// Select the records of a tier covering the last rangeMinutes (0 = all)
+// and timestamps from..to (inclusive, timeline minutes), starting no
+// earlier than sequence `since` if the tier still holds it
+HistoryQuery makeHistoryQuery(HistoryTier tier, uint32_t rangeMinutes, uint32_t from, uint32_t to, uint32_t since) {
+  HistoryQuery query;
+  query.tier = tier;
+  query.step = 1;
+  query.scanned = 0;
+  query.windowed = false;
+  if (tier == TIER_RAW) {
+    query.end = history.rawSequence();
+    query.first = history.rawOldest();
+  } else if (tier == TIER_LOG) {
+    lockLogs();
+    query.end = dataSegments.recordCount();
+    query.first = dataSegments.oldestRecord();
+    unlockLogs();
+  } else if (tier == TIER_HOURLY) {
+    query.end = history.hourly().sequence();
+    query.first = history.hourly().oldestSequence();
+  } else {
+    query.end = history.daily().sequence();
+    query.first = history.daily().oldestSequence();
+  }
   
-  for (int i = 0; i < dataCount; i++) {
-    if (i > 0) json += ",";
-    json += "{";
-    json += "\"t\":" + String(dataLog[i].timestamp) + ",";
-    json += "\"v\":" + String(dataLog[i].voltage, 1) + ",";
-    json += "\"c\":" + String(dataLog[i].current, 1) + ",";
-    json += "\"s\":" + String(dataLog[i].soc, 1);
-    json += "}";
+  uint32_t newestTime;
+  if (rangeMinutes > 0 && query.first != query.end &&
+      getHistoryTimestamp(tier, query.end - 1, newestTime) && newestTime > rangeMinutes) {
+    from = max(from, newestTime - rangeMinutes);
+  }
+  if (from > 0) {
+    query.first = findHistoryTime(tier, query.first, query.end, from, query.scanned);
+  }
+  if (to < UINT32_MAX) {
+    query.end = findHistoryTime(tier, query.first, query.end, to + 1, query.scanned);
   }
   
-  json += "]}";
+  // A cursor older than what we hold (or from before a log reset) gets
+  // everything; the client sees `first` differ from its cursor and reloads
+  if (since - query.first <= query.end - query.first) {
+    query.first = since;
+  }
+  return query;
+}
+
+// Parse res, range, since, from, to and max_points parameters of a /data or
+// /data.bin request. from and to are in the same minutes as the records'
+// `t`; max_points thins the window out to every n-th record.
+HistoryQuery parseHistoryRequest(AsyncWebServerRequest* request) {
+  String resolution = request->hasParam("res") ? request->getParam("res")->value() : String("");
+  uint32_t rangeMinutes = request->hasParam("range") ? request->getParam("range")->value().toInt() : 0;
+  uint32_t since = request->hasParam("since") ? strtoul(request->getParam("since")->value().c_str(), NULL, 10) : 0;
+  uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+  uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : UINT32_MAX;
+  uint32_t maxPoints = request->hasParam("max_points") ? strtoul(request->getParam("max_points")->value().c_str(), NULL, 10) : 0;
+  
+  // A window reaching back to `from` needs a tier covering that far
+  uint32_t now = timeBase.now();
+  uint32_t tierRange = rangeMinutes;
+  if (from > 0 && from < now) tierRange = max(tierRange, now - from);
+  
+  HistoryQuery query = makeHistoryQuery(selectHistoryTier(resolution, tierRange), rangeMinutes, from, to, since);
+  uint32_t count = query.end - query.first;
+  if (maxPoints > 0 && count > maxPoints) {
+    query.step = (count + maxPoints - 1) / maxPoints;
+  }
+  query.windowed = from > 0 || to < UINT32_MAX || maxPoints > 0;
+  return query;
+}
+
+// Name of a tier as used by the res parameter and in responses
+const char* historyTierName(HistoryTier tier) {
+  switch (tier) {
+    case TIER_HOURLY: return "hour";
+    case TIER_DAILY: return "day";
+    case TIER_LOG: return "log";
+    default: return "raw";
+  }
+}
+
+// A response only changes when a record is added to its tier, so the
+// tier's next sequence number identifies it
+String historyETag(const HistoryQuery& query) {
+  // The epoch is part of the response, so setting it invalidates copies
+  String etag = "\"" + String(historyTierName(query.tier)) + "-" + String(query.end) + "-" +
+                String(timeBase.getEpoch());
+  // A window can end before the newest record or thin it out
+  if (query.windowed) etag += "-" + String(query.first) + "-" + String(query.step);
+  return etag + "\"";
+}
+
+// Answer 304 with no body if the client already has this version
+bool sendIfNotModified(AsyncWebServerRequest* request, const String& etag) {
+  if (!request->hasHeader("If-None-Match") || request->getHeader("If-None-Match")->value() != etag) {
+    return false;
+  }
+  AsyncWebServerResponse* response = request->beginResponse(304);
+  response->addHeader("ETag", etag);
+  request->send(response);
+  return true;
+}
+
+// Record formatter for raw points from the RAM ring
+size_t formatRawRecord(char* out, size_t size, uint32_t sequence, void* context) {
+  ((HistoryResponse*)context)->visited++;
+  DataPoint point;
+  if (!history.getPoint(sequence, point)) return 0;
+  return formatPointJson(out, size, point);
+}
+
+// Record formatter for the flash log: points are decoded from the segments
+// as the response is sent, a buffer at a time. sendHistory() holds
+// lockLogs() around each chunk.
+size_t formatLogRecord(char* out, size_t size, uint32_t sequence, void* context) {
+  HistoryResponse* response = (HistoryResponse*)context;
+  PackedPoint packed;
+  if (!response->reader.read(sequence, packed)) return 0;
+  return formatPointJson(out, size, unpackPoint(packed, history.timestampOf(sequence)));
+}
+
+// Record formatter for rolled-up tiers: mean as t/v/c/s like the raw
+// points, plus min (vl, cl, sl) and max (vh, ch, sh)
+size_t formatRollupRecord(char* out, size_t size, uint32_t sequence, void* context) {
+  HistoryResponse* response = (HistoryResponse*)context;
+  const HistoryQuery* query = &response->query;
+  response->visited++;
+  RollupPoint point;
+  bool found = (query->tier == TIER_HOURLY) ? history.hourly().get(sequence, point) : history.daily().get(sequence, point);
+  if (!found) return 0;
+  return formatRollupJson(out, size, point);
+}
+
+// End of a /data response: how many records finding and sending the window
+// touched (binary search probes, RAM lookups and points decoded from flash)
+size_t formatHistorySuffix(char* out, size_t size, void* context) {
+  const HistoryResponse* response = (const HistoryResponse*)context;
+  uint32_t scanned = response->query.scanned + response->visited + response->reader.decoded;
+  int len = snprintf(out, size, "],\"scanned\":%lu}", (unsigned long)scanned);
+  return len > 0 ? len : 0;
+}
+
+// Stream history records as JSON, oldest first. Records are formatted one
+// at a time straight into the TCP send buffer, so the response needs a
+// single fixed-size allocation however long the history is.
+// `first` is the sequence number of the first record and `seq` the one
+// after the last - pass it back as `since` to get only newer records.
+void sendHistory(AsyncWebServerRequest* request, const HistoryQuery& query) {
+  String etag = historyETag(query);
+  if (sendIfNotModified(request, etag)) return;
+  
+  JsonArrayStream::RecordFormatter formatter = (query.tier == TIER_RAW) ? formatRawRecord :
+                                               (query.tier == TIER_LOG) ? formatLogRecord : formatRollupRecord;
+  char prefix[128];
+  snprintf(prefix, sizeof(prefix), "{\"res\":\"%s\",\"first\":%lu,\"seq\":%lu,\"epoch\":%lu,\"data\":[",
+           historyTierName(query.tier), (unsigned long)query.first, (unsigned long)query.end,
+           (unsigned long)timeBase.getEpoch());
+  
+  std::shared_ptr<HistoryResponse> state = std::make_shared<HistoryResponse>(query, prefix, formatter, dataSegments);
+  state->stream.setSuffixFormatter(formatHistorySuffix);
+  AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+    [state](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      if (state->query.tier != TIER_LOG) return state->stream.read(buffer, maxLen);
+      lockLogs();
+      size_t n = state->stream.read(buffer, maxLen);
+      unlockLogs();
+      return n;
+    });
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+// Serve a history tier in the packed binary format (HistoryFormat.h).
+// Raw points keep their fixed-point encoding; a record overwritten while
+// the response is in flight is sent as zeros.
+void sendHistoryBinary(AsyncWebServerRequest* request, const HistoryQuery& query) {
+  if (query.tier == TIER_LOG) {
+    request->send(400, "text/plain", "res=log is only served by /data");
+    return;
+  }
+  String etag = historyETag(query);
+  if (sendIfNotModified(request, etag)) return;
+  
+  HistoryTier tier = query.tier;
+  std::shared_ptr<BinaryHistoryResponse> state = std::make_shared<BinaryHistoryResponse>();
+  HistoryBinHeader& header = state->header;
+  header.magic = HISTORY_BIN_MAGIC;
+  header.version = HISTORY_BIN_VERSION;
+  header.headerSize = sizeof(HistoryBinHeader);
+  header.recordSize = (tier == TIER_RAW) ? sizeof(HistoryPackedRecord) : sizeof(RollupPoint);
+  header.recordFormat = (tier == TIER_RAW) ? HISTORY_FORMAT_PACKED : HISTORY_FORMAT_ROLLUP;
+  header.count = (query.end - query.first + query.step - 1) / query.step;
+  header.firstSequence = query.first;
+  header.intervalSec = (tier == TIER_RAW) ? logIntervalMs / 1000 :
+                       (tier == TIER_HOURLY) ? MINUTES_PER_HOUR * 60 : MINUTES_PER_DAY * 60;
+  header.intervalSec *= query.step;
+  header.epoch = timeBase.getEpoch();
+  header.voltageScale = (tier == TIER_RAW) ? POINT_VOLTAGE_SCALE : 1.0;
+  header.currentScale = (tier == TIER_RAW) ? POINT_CURRENT_SCALE : 1.0;
+  header.socScale = (tier == TIER_RAW) ? POINT_SOC_SCALE : 1.0;
+  state->tier = tier;
+  state->step = query.step;
+  
+  size_t length = header.headerSize + (size_t)header.count * header.recordSize;
+  AsyncWebServerResponse* response = request->beginResponse("application/octet-stream", length,
+    [state, length](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      const HistoryBinHeader& header = state->header;
+      size_t written = 0;
+      while (written < maxLen && index + written < length) {
+        size_t pos = index + written;
+        size_t n;
+        if (pos < header.headerSize) {
+          n = min((size_t)header.headerSize - pos, maxLen - written);
+          memcpy(buffer + written, (const uint8_t*)&header + pos, n);
+        } else {
+          size_t record = (pos - header.headerSize) / header.recordSize;
+          size_t offset = (pos - header.headerSize) % header.recordSize;
+          n = min((size_t)header.recordSize - offset, maxLen - written);
+          uint8_t bytes[sizeof(RollupPoint)];
+          if (copyHistoryRecord(state->tier, header.firstSequence + record * state->step, bytes)) {
+            memcpy(buffer + written, bytes + offset, n);
+          } else {
+            memset(buffer + written, 0, n);
+          }
+        }
+        written += n;
+      }
+      return written;
+    });
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "no-cache");
+  // Records are at firstSequence + i * step
+  response->addHeader("X-Record-Step", String(query.step));
+  response->addHeader("X-Records-Scanned", String(query.scanned + header.count));
+  request->send(response);
+}
+
+// Latest voltage/current/SOC snapshot, shared by /current and /events
+String getCurrentJSON() {
+  Sample sample = getLatestSample();
+  String json = "{";
+  json += "\"voltage\":" + String(sample.voltage, 1) + ",";
+  json += "\"current\":" + String(sample.current, 1) + ",";
+  uint32_t lastFullTime = socTracker.getLastFullTime();
+  json += "\"soc\":" + String(socTracker.getSoc(), 1) + ",";
+  json += "\"lastFull\":" + String(lastFullTime == SOC_NEVER_FULL ? -1L : (long)lastFullTime);
+  json += "}";
   return json;
 }
 
+// Publish one snapshot to every /events client. Sending never blocks: the
+// event source queues per client (bounded), and a client that cannot keep
+// up drops snapshots instead of holding up the others. Snapshots are
+// latest-value, so a dropped one is simply superseded by the next.
+void pushLiveReading() {
+  if (events.count() == 0) return;
+  liveEventId++;
+  events.send(getCurrentJSON().c_str(), "reading", liveEventId);
+}
+
 void setup() {
   Serial.begin(115200);
   delay(1000);
@@ -347,19 +1323,27 @@ void setup() {
   // Load settings first (battery capacity, log interval)
   loadSettings();
   
-  // Load data and SOC from flash
+  // Load data and SOC from flash (no saved SOC: socTracker starts at 100%)
+  history.setSink(&persistSink);
   bool dataLoaded = loadData();
-  if (!loadSoc()) {
-    // If no saved SOC, start at 100%
-    socPercentage = 100.0;
-    ampHoursRemaining = batteryCapacityAh;
+  loadSoc();
+  
+  // Continue the log's timeline: the first point of this boot goes one
+  // interval after the last stored one. The time the monitor was off is
+  // added once a browser supplies the wall clock.
+  if (dataLoaded) {
+    uint32_t lastTimestamp = history.timestampOf(history.rawSequence() - 1);
+    timeBase.resume(lastTimestamp + logIntervalMs / 60000, dataSegments.getUserData());
   }
+  dataSegments.setUserData(timeBase.getEpoch());
+  anchorSegments.setUserData(timeBase.getEpoch());
   
   // Initialize I2C with specified pins
   Wire.begin(SDA_PIN, SCL_PIN);
+  Wire.setClock(I2C_CLOCK_HZ);
   
-  // Initialize INA226
-  if (!ina.begin()) {
+  // Initialize and calibrate the INA226
+  if (!sensor.begin()) {
     Serial.println("ERROR: Failed to initialize INA226!");
     Serial.println("Check connections and I2C address.");
     while (1) {
@@ -369,14 +1353,45 @@ void setup() {
   
   Serial.println("INA226 initialized successfully");
   
-  // Configure the INA226
-  ina.setMaxCurrentShunt(50.0, SHUNT_RESISTOR);
+  applyAcquisitionProfile(acquisitionProfile);
+  for (size_t i = 0; i < ACQUISITION_PROFILE_COUNT; i++) {
+    if (profileConversionUs(i) < FASTEST_SAMPLE_US) {
+      Serial.print("ERROR: profile ");
+      Serial.print(acquisitionProfiles[i].name);
+      Serial.println(" is faster than FASTEST_SAMPLE_US, the sample ring will overrun");
+    }
+  }
   
   Serial.print("Shunt Resistor: ");
   Serial.print(SHUNT_RESISTOR, 4);
   Serial.println(" Ohm");
+  Serial.print("Acquisition profile: ");
+  Serial.print(acquisitionProfiles[acquisitionProfile].name);
+  Serial.print(" (");
+  Serial.print(profileConversionUs(acquisitionProfile));
+  Serial.println(" us per reading)");
   Serial.println();
   
+  if (USE_CONVERSION_READY_ALERT) {
+    // Assert ALERT whenever a conversion completes
+    ina.setAlertRegister(INA226_CONVERSION_READY);
+    pinMode(INA226_ALERT_PIN, INPUT_PULLUP);
+  }
+  
+  // Start sampling - from here on only samplingTask touches the INA226
+  xTaskCreatePinnedToCore(samplingTask, "ina226", SAMPLING_TASK_STACK, NULL,
+                          SAMPLING_TASK_PRIORITY, &samplingTaskHandle, SAMPLING_TASK_CORE);
+  
+  if (USE_CONVERSION_READY_ALERT) {
+    attachInterrupt(digitalPinToInterrupt(INA226_ALERT_PIN), onConversionReady, FALLING);
+    Serial.print("Sampling on conversion-ready alert, GPIO");
+    Serial.println(INA226_ALERT_PIN);
+  } else {
+    Serial.print("Sampling task started at ");
+    Serial.print(SAMPLE_RATE_HZ);
+    Serial.println(" Hz");
+  }
+  
   // Setup WiFi Access Point
   Serial.println("Setting up WiFi Access Point...");
   WiFi.mode(WIFI_AP);
@@ -391,23 +1406,139 @@ void setup() {
   // Setup web server routes
   server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html");
   
+  // /data?res=raw|hour|day&range=<minutes>&since=<sequence>
+  //      &from=<minute>&to=<minute>&max_points=<n>
   server.on("/data", HTTP_GET, [](AsyncWebServerRequest *request){
-    request->send(200, "application/json", getDataJSON());
+    sendHistory(request, parseHistoryRequest(request));
+  });
+  
+  // Same parameters as /data, packed binary records (see HistoryFormat.h)
+  server.on("/data.bin", HTTP_GET, [](AsyncWebServerRequest *request){
+    sendHistoryBinary(request, parseHistoryRequest(request));
   });
   
   server.on("/current", HTTP_GET, [](AsyncWebServerRequest *request){
+    request->send(200, "application/json", getCurrentJSON());
+  });
+  
+  // Live stream: send the current snapshot straight away, then whatever
+  // pushLiveReading() publishes. Ask browsers to retry after 2 s if dropped.
+  events.onConnect([](AsyncEventSourceClient *client){
+    client->send(getCurrentJSON().c_str(), "reading", liveEventId, 2000);
+  });
+  server.addHandler(&events);
+  
+  server.on("/debug/acquisition", HTTP_GET, [](AsyncWebServerRequest *request){
+    String json = "{";
+    json += "\"mode\":\"" + String(USE_CONVERSION_READY_ALERT ? "alert" : "poll") + "\",";
+    json += "\"profile\":\"" + String(acquisitionProfiles[acquisitionProfile].name) + "\",";
+    json += "\"conversionUs\":" + String(profileConversionUs(acquisitionProfile)) + ",";
+    json += "\"samplesPerSec\":" + String(acquisitionStats.samplesPerSec, 1) + ",";
+    json += "\"totalSamples\":" + String(acquisitionStats.totalSamples) + ",";
+    json += "\"missedConversions\":" + String(acquisitionStats.missedConversions) + ",";
+    json += "\"alertTimeouts\":" + String(acquisitionStats.alertTimeouts) + ",";
+    json += "\"integratorDropped\":" + String(analytics.droppedSamples());
+    json += "}";
+    request->send(200, "application/json", json);
+  });
+  
+  server.on("/debug/storage", HTTP_GET, [](AsyncWebServerRequest *request){
+    lockLogs();
+    SegmentLogStats stats = dataSegments.getStats();
+    uint32_t records = dataSegments.recordCount();
+    uint32_t oldestRecord = dataSegments.oldestRecord();
+    uint32_t codedBytes = dataSegments.getCodedBytes();
+    float compressionRatio = dataSegments.compressionRatio();
+    float writeAmplification = dataSegments.writeAmplification();
+    unlockLogs();
+    // What rewriting the whole datalog.bin per point used to cost
+    uint32_t legacyBytes = (stats.payloadBytes / sizeof(PackedPoint)) *
+                           (3 * sizeof(uint32_t) + LEGACY_DATA_POINTS * sizeof(LegacyDataPoint));
+    String json = "{";
+    json += "\"records\":" + String(records) + ",";
+    json += "\"oldestRecord\":" + String(oldestRecord) + ",";
+    json += "\"recordBytes\":" + String(sizeof(PackedPoint)) + ",";
+    json += "\"codedBytes\":" + String(codedBytes) + ",";
+    json += "\"compressionRatio\":" + String(compressionRatio, 2) + ",";
+    json += "\"loadUs\":" + String(dataLoadUs) + ",";
+    json += "\"ramPoints\":" + String(MAX_DATA_POINTS) + ",";
+    json += "\"timeAnchors\":" + String(history.anchors().size()) + ",";
+    json += "\"payloadBytes\":" + String(stats.payloadBytes) + ",";
+    json += "\"flashBytes\":" + String(stats.flashBytes) + ",";
+    json += "\"legacyFlashBytes\":" + String(legacyBytes) + ",";
+    json += "\"segmentsRotated\":" + String(stats.segmentsRotated) + ",";
+    json += "\"writeAmplification\":" + String(writeAmplification, 2) + ",";
+    json += "\"persist\":{";
+    json += "\"marks\":" + String(persistStats.marks) + ",";
+    json += "\"socWrites\":" + String(persistStats.socWrites) + ",";
+    json += "\"socSequence\":" + String(socStore.getSequence()) + ",";
+    json += "\"settingsWrites\":" + String(persistStats.settingsWrites) + ",";
+    json += "\"records\":" + String(persistStats.records) + ",";
+    json += "\"dropped\":" + String(persistStats.dropped) + ",";
+    json += "\"queued\":" + String(persistQueue ? (unsigned)uxQueueMessagesWaiting(persistQueue) : 0) + ",";
+    json += "\"pending\":" + String(persistSchedule.pending());
+    json += "}}";
+    request->send(200, "application/json", json);
+  });
+  
+  server.on("/debug/heap", HTTP_GET, [](AsyncWebServerRequest *request){
     String json = "{";
-    json += "\"voltage\":" + String(ina.getBusVoltage(), 1) + ",";
-    json += "\"current\":" + String(ina.getCurrent_mA() / 1000.0, 1) + ",";
-    json += "\"soc\":" + String(socPercentage, 1);
+    json += "\"freeHeap\":" + String(ESP.getFreeHeap()) + ",";
+    json += "\"maxAllocHeap\":" + String(ESP.getMaxAllocHeap());
     json += "}";
     request->send(200, "application/json", json);
   });
   
+  server.on("/debug/display", HTTP_GET, [](AsyncWebServerRequest *request){
+    const DisplayStats& stats = display.getStats();
+    String json = "{";
+    json += "\"fastGpio\":" + String(DISPLAY_FAST_GPIO ? "true" : "false") + ",";
+    json += "\"brightness\":" + String(display.getBrightness()) + ",";
+    json += "\"frameUs\":" + String(FRAME_US) + ",";
+    json += "\"arduinoSegmentCycles\":" + String(stats.arduinoSegmentCycles) + ",";
+    json += "\"registerSegmentCycles\":" + String(stats.registerSegmentCycles) + ",";
+    json += "\"ticks\":" + String(stats.ticks) + ",";
+    json += "\"avgTickCycles\":" + String(stats.ticks > 0 ? (uint32_t)(stats.tickCycles / stats.ticks) : 0) + ",";
+    json += "\"maxTickCycles\":" + String(stats.maxTickCycles);
+    json += "}";
+    request->send(200, "application/json", json);
+  });
+  
+  // Stack headroom and CPU share of each application task since the
+  // previous request
+  server.on("/debug/tasks", HTTP_GET, [](AsyncWebServerRequest *request){
+    int64_t now = esp_timer_get_time();
+    int64_t windowUs = now - tasksReportedUs;
+    tasksReportedUs = now;
+    String json = "{\"windowMs\":" + String((uint32_t)(windowUs / 1000)) + ",\"tasks\":[";
+    for (int i = 0; i < TASK_COUNT; i++) {
+      AppTaskInfo& task = appTasks[i];
+      uint32_t busyUs = task.busyUs;
+      uint32_t busyDelta = busyUs - task.reportedBusyUs;
+      task.reportedBusyUs = busyUs;
+      if (i > 0) json += ",";
+      json += "{\"name\":\"" + String(task.name) + "\",";
+      json += "\"core\":" + String(task.handle ? (int)xTaskGetAffinity(task.handle) : -1) + ",";
+      json += "\"priority\":" + String(task.handle ? (int)uxTaskPriorityGet(task.handle) : -1) + ",";
+      json += "\"stackFree\":" + String(task.handle ? (unsigned)uxTaskGetStackHighWaterMark(task.handle) : 0) + ",";
+      json += "\"cpuPercent\":" + String(windowUs > 0 ? busyDelta * 100.0 / windowUs : 0.0, 2) + "}";
+    }
+    json += "]}";
+    request->send(200, "application/json", json);
+  });
+  
   server.on("/settings", HTTP_GET, [](AsyncWebServerRequest *request){
     String json = "{";
-    json += "\"batteryCapacity\":" + String(batteryCapacityAh, 1) + ",";
-    json += "\"logInterval\":" + String(logIntervalMs / 60000);  // Convert to minutes
+    json += "\"batteryCapacity\":" + String(socTracker.getCapacity(), 1) + ",";
+    json += "\"logInterval\":" + String(logIntervalMs / 60000) + ",";  // Convert to minutes
+    json += "\"brightness\":" + String(displayBrightness) + ",";
+    json += "\"profile\":\"" + String(acquisitionProfiles[acquisitionProfile].name) + "\",";
+    json += "\"profiles\":[";
+    for (size_t i = 0; i < ACQUISITION_PROFILE_COUNT; i++) {
+      if (i > 0) json += ",";
+      json += "\"" + String(acquisitionProfiles[i].name) + "\"";
+    }
+    json += "]";
     json += "}";
     request->send(200, "application/json", json);
   });
@@ -418,9 +1549,10 @@ void setup() {
     if (request->hasParam("batteryCapacity", true)) {
       float newCapacity = request->getParam("batteryCapacity", true)->value().toFloat();
       if (newCapacity > 0 && newCapacity <= 10000) {  // Sanity check
-        batteryCapacityAh = newCapacity;
-        // Reset SOC to match new capacity
-        ampHoursRemaining = batteryCapacityAh * (socPercentage / 100.0);
+        // Keeps the SOC percentage, rescales the amp-hours remaining
+        portENTER_CRITICAL(&socMux);
+        socTracker.setCapacity(newCapacity);
+        portEXIT_CRITICAL(&socMux);
         updated = true;
       }
     }
@@ -433,9 +1565,25 @@ void setup() {
       }
     }
     
+    if (request->hasParam("profile", true)) {
+      int newProfile = findAcquisitionProfile(request->getParam("profile", true)->value());
+      if (newProfile >= 0) {
+        acquisitionProfile = newProfile;  // Picked up by the sampling task
+        updated = true;
+      }
+    }
+    
+    if (request->hasParam("brightness", true)) {
+      long newBrightness = request->getParam("brightness", true)->value().toInt();
+      if (newBrightness >= 0 && newBrightness <= 100) {
+        displayBrightness = newBrightness;
+        displayOutput.setBrightness(displayBrightness);
+        updated = true;
+      }
+    }
+    
     if (updated) {
-      saveSettings();
-      saveSoc();  // Save updated ampHoursRemaining
+      markDirty(PERSIST_SETTINGS | PERSIST_SOC, true);  // Save updated ampHoursRemaining too
       request->send(200, "text/plain", "Settings saved");
     } else {
       request->send(400, "text/plain", "Invalid settings");
@@ -443,103 +1591,62 @@ void setup() {
   });
 
   server.on("/setBatteryFull", HTTP_POST, [](AsyncWebServerRequest *request){
-    // Set SOC to 100%
-    socPercentage = 100.0;
-    ampHoursRemaining = batteryCapacityAh;
-    saveSoc();
+    portENTER_CRITICAL(&socMux);
+    socTracker.setFull();
+    portEXIT_CRITICAL(&socMux);
+    markDirty(PERSIST_SOC, true);
     
     Serial.println("Manual SOC reset - Battery set to 100%");
     
     request->send(200, "text/plain", "Battery SOC set to 100%");
   });
   
-  server.begin();
-  Serial.println("Web server started");
+  // Wall-clock time from the dashboard (Unix seconds), sent on connect
+  server.on("/setTime", HTTP_POST, [](AsyncWebServerRequest *request){
+    if (!request->hasParam("epoch", true)) {
+      request->send(400, "text/plain", "Missing epoch");
+      return;
+    }
+    uint32_t unixSeconds = strtoul(request->getParam("epoch", true)->value().c_str(), NULL, 10);
+    WallClockResult result = timeBase.setWallClock(unixSeconds);
+    if (result == WALL_CLOCK_REJECTED) {
+      request->send(400, "text/plain", "Time out of range");
+      return;
+    }
+    if (result == WALL_CLOCK_SET) {
+      markDirty(PERSIST_EPOCH, true);
+      Serial.println("Wall clock set - log timestamps are now absolute");
+    }
+    request->send(200, "application/json", "{\"epoch\":" + String(timeBase.getEpoch()) + "}");
+  });
   
-  // Set bootTime - if data was loaded, it already has the original bootTime
-  // Otherwise, set it to current time
-  if (!dataLoaded) {
-    bootTime = millis();
-  }
-  lastLogTime = millis() - logIntervalMs;  // Trigger immediate log on first loop
-  lastSocCalcTime = millis();  // Initialize SOC calculation timer
+  loadRollups();
+  analytics.begin(logIntervalMs);  // Logs at once on the first tick, SOC from here on
   
   // Initialize Charlieplexed display
   display.begin();
+  displayOutput.setBrightness(displayBrightness);
   Serial.println("Charlieplexed 7-segment displays initialized");
   
   // Set initial display values
-  display.setVoltageAndSoc(12.5, socPercentage);
-  display.setCurrent(0.0);
+  displayOutput.show(12.5, socTracker.getSoc(), 0.0);
   
   // Log first data point immediately on first boot
   if (!dataLoaded) {
-    logData();
-  }
-}
-
-void loop() {
-  unsigned long currentTime = millis();
-  static unsigned long lastDisplayBufferUpdate = 0;
-  static unsigned long lastDisplayRefresh = 0;
-  
-  // Refresh Charlieplex display at controlled rate
-  if (currentTime - lastDisplayRefresh >= REFRESH_INTERVAL_MS) {
-    display.refresh();
-    lastDisplayRefresh = currentTime;
-  }
-  
-  // Update display buffer values every 500ms
-  if (currentTime - lastDisplayBufferUpdate >= 500) {
-    float voltage = ina.getBusVoltage();
-    float current = ina.getCurrent_mA() / 1000.0;
-    display.setVoltageAndSoc(voltage, socPercentage);
-    display.setCurrent(current);
-    lastDisplayBufferUpdate = currentTime;
+    analytics.logData(getLatestSample(), logIntervalMs);
   }
   
-  // Calculate SOC every 10 seconds
-  if (currentTime - lastSocCalcTime >= SOC_CALC_INTERVAL_MS) {
-    calculateSoc();
-  }
+  // From here on the application tasks do all the work
+  startAppTasks();
+  Serial.println("Application tasks started");
   
-  // Log data at configured interval
-  if (currentTime - lastLogTime >= logIntervalMs) {
-    logData();
-    lastLogTime = currentTime;
-  }
-  
-  // Small delay to prevent tight loop
-  delayMicroseconds(100);
+  // Only now: requests read the tiers loadRollups() rebuilt and the flash
+  // logs under persistMutex, which startAppTasks() creates
+  server.begin();
+  Serial.println("Web server started");
 }
 
-void logData() {
-  float voltage = ina.getBusVoltage();
-  float current = ina.getCurrent_mA() / 1000.0;  // Convert to Amps
-  
-  // Calculate timestamp in minutes since boot
-  unsigned long minutesSinceBoot = (millis() - bootTime) / 60000;
-  
-  // Store data point
-  dataLog[dataIndex].timestamp = minutesSinceBoot;
-  dataLog[dataIndex].voltage = voltage;
-  dataLog[dataIndex].current = current;
-  dataLog[dataIndex].soc = socPercentage;
-  
-  // Update circular buffer index
-  dataIndex = (dataIndex + 1) % MAX_DATA_POINTS;
-  if (dataCount < MAX_DATA_POINTS) {
-    dataCount++;
-  }
-  
-  // Save to flash
-  saveData();
-  
-  Serial.print("Data logged - V:");
-  Serial.print(voltage, 2);
-  Serial.print("V I:");
-  Serial.print(current, 2);
-  Serial.print("A SOC:");
-  Serial.print(socPercentage, 1);
-  Serial.println("%");
+// Everything runs in the application tasks; free the Arduino loop task
+void loop() {
+  vTaskDelete(NULL);
 }
\ No newline at end of file
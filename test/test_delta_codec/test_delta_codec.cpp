@@ -0,0 +1,126 @@
+// Zigzag, varint and point delta coding (DeltaCodec.h)
+
+#include <unity.h>
+#include <string.h>
+#include "DeltaCodec.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static PackedPoint point(uint16_t voltage, int16_t current, uint8_t soc) {
+  PackedPoint p;
+  p.voltage = voltage;
+  p.current = current;
+  p.soc = soc;
+  return p;
+}
+
+static void assertSamePoint(const PackedPoint& expected, const PackedPoint& actual) {
+  TEST_ASSERT_EQUAL_UINT16(expected.voltage, actual.voltage);
+  TEST_ASSERT_EQUAL_INT16(expected.current, actual.current);
+  TEST_ASSERT_EQUAL_UINT8(expected.soc, actual.soc);
+}
+
+void test_zigzag_round_trip(void) {
+  const int32_t values[] = {0, 1, -1, 2, -2, 63, -64, 32767, -32768, INT32_MAX, INT32_MIN};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    TEST_ASSERT_EQUAL_INT32(values[i], zigzagDecode(zigzagEncode(values[i])));
+  }
+  // Small magnitudes stay small whatever their sign
+  TEST_ASSERT_EQUAL_UINT32(0, zigzagEncode(0));
+  TEST_ASSERT_EQUAL_UINT32(1, zigzagEncode(-1));
+  TEST_ASSERT_EQUAL_UINT32(2, zigzagEncode(1));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, zigzagEncode(INT32_MIN));
+}
+
+void test_varint_round_trip(void) {
+  const uint32_t values[] = {0, 1, 127, 128, 16383, 16384, 65535, 2097151, 2097152, UINT32_MAX};
+  const size_t lengths[] = {1, 1, 1, 2, 2, 3, 3, 3, 4, 5};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    uint8_t bytes[5];
+    size_t len = putVarint(bytes, values[i]);
+    TEST_ASSERT_EQUAL_size_t(lengths[i], len);
+    uint32_t decoded;
+    TEST_ASSERT_EQUAL_size_t(len, getVarint(bytes, len, decoded));
+    TEST_ASSERT_EQUAL_UINT32(values[i], decoded);
+  }
+}
+
+void test_varint_truncated(void) {
+  uint8_t bytes[5];
+  size_t len = putVarint(bytes, 300000);
+  uint32_t decoded;
+  for (size_t cut = 0; cut < len; cut++) {
+    TEST_ASSERT_EQUAL_size_t(0, getVarint(bytes, cut, decoded));
+  }
+}
+
+// Full-scale jumps in every field, both ways, still round-trip exactly and
+// fit DELTA_POINT_MAX_BYTES
+void test_point_extreme_deltas(void) {
+  const PackedPoint points[] = {
+    point(0, 0, 0),
+    point(UINT16_MAX, INT16_MAX, UINT8_MAX),
+    point(0, INT16_MIN, 0),
+    point(UINT16_MAX, INT16_MAX, UINT8_MAX),
+    point(32768, 0, 128),
+    point(32767, -1, 127),
+    point(1250, -150, 160),
+    point(1250, -150, 160)
+  };
+  const size_t count = sizeof(points) / sizeof(points[0]);
+  uint8_t coded[count * DELTA_POINT_MAX_BYTES];
+  size_t codedLen = 0;
+  PointDeltaEncoder encoder;
+  for (size_t i = 0; i < count; i++) {
+    size_t len = encoder.encode(points[i], coded + codedLen);
+    TEST_ASSERT_TRUE(len >= 3 && len <= DELTA_POINT_MAX_BYTES);
+    codedLen += len;
+  }
+
+  PointDeltaDecoder decoder;
+  size_t pos = 0;
+  for (size_t i = 0; i < count; i++) {
+    PackedPoint decoded;
+    size_t used = decoder.decode(coded + pos, codedLen - pos, decoded);
+    TEST_ASSERT_TRUE(used > 0);
+    assertSamePoint(points[i], decoded);
+    pos += used;
+  }
+  TEST_ASSERT_EQUAL_size_t(codedLen, pos);
+}
+
+void test_steady_point_costs_three_bytes(void) {
+  PointDeltaEncoder encoder;
+  uint8_t bytes[DELTA_POINT_MAX_BYTES];
+  encoder.encode(point(1280, -250, 170), bytes);
+  TEST_ASSERT_EQUAL_size_t(3, encoder.encode(point(1280, -250, 170), bytes));
+}
+
+// A point cut anywhere decodes as nothing, and leaves the chain where it was
+void test_point_truncated(void) {
+  PointDeltaEncoder encoder;
+  uint8_t coded[2 * DELTA_POINT_MAX_BYTES];
+  size_t first = encoder.encode(point(1300, 100, 180), coded);
+  size_t second = encoder.encode(point(60000, -30000, 10), coded + first);
+
+  for (size_t cut = 0; cut < second; cut++) {
+    PointDeltaDecoder decoder;
+    PackedPoint decoded;
+    TEST_ASSERT_EQUAL_size_t(first, decoder.decode(coded, first, decoded));
+    TEST_ASSERT_EQUAL_size_t(0, decoder.decode(coded + first, cut, decoded));
+    TEST_ASSERT_EQUAL_size_t(second, decoder.decode(coded + first, second, decoded));
+    assertSamePoint(point(60000, -30000, 10), decoded);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_zigzag_round_trip);
+  RUN_TEST(test_varint_round_trip);
+  RUN_TEST(test_varint_truncated);
+  RUN_TEST(test_point_extreme_deltas);
+  RUN_TEST(test_steady_point_costs_three_bytes);
+  RUN_TEST(test_point_truncated);
+  return UNITY_END();
+}
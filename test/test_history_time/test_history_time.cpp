@@ -0,0 +1,127 @@
+// Dating raw points by time anchors, and finding a time in a tier
+// (TimeAnchors in PackedPoint.h, findFirstAtOrAfter() in HistoryStore.h)
+
+#include <unity.h>
+#include "PackedPoint.h"
+#include "HistoryStore.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static TimeAnchor anchor(uint32_t sequence, uint32_t timestamp, uint16_t intervalMinutes) {
+  TimeAnchor a = {sequence, timestamp, intervalMinutes, 0};
+  return a;
+}
+
+void test_no_anchors(void) {
+  TimeAnchors<4> anchors;
+  TEST_ASSERT_EQUAL_UINT32(0, anchors.timestampOf(10));
+  TEST_ASSERT_TRUE(anchors.needsAnchor(0, 100, 10));
+}
+
+// Each point is dated by the newest anchor at or before it: on an anchor,
+// between anchors, and past the newest one
+void test_timestamp_across_anchors(void) {
+  TimeAnchors<4> anchors;
+  anchors.add(anchor(0, 1000, 10));
+  anchors.add(anchor(5, 2000, 1));     // Reboot: clock jumped, interval changed
+  anchors.add(anchor(20, 2100, 5));
+
+  TEST_ASSERT_EQUAL_UINT32(1000, anchors.timestampOf(0));
+  TEST_ASSERT_EQUAL_UINT32(1040, anchors.timestampOf(4));
+  TEST_ASSERT_EQUAL_UINT32(2000, anchors.timestampOf(5));
+  TEST_ASSERT_EQUAL_UINT32(2014, anchors.timestampOf(19));
+  TEST_ASSERT_EQUAL_UINT32(2100, anchors.timestampOf(20));
+  TEST_ASSERT_EQUAL_UINT32(2150, anchors.timestampOf(30));
+}
+
+// Points older than every anchor still held are extrapolated backwards
+// from the oldest one
+void test_timestamp_before_oldest_anchor(void) {
+  TimeAnchors<2> anchors;
+  anchors.add(anchor(0, 500, 10));
+  anchors.add(anchor(10, 1000, 10));
+  anchors.add(anchor(20, 2000, 10));   // The first is no longer readable
+  TEST_ASSERT_EQUAL_UINT32(950, anchors.timestampOf(5));
+  TEST_ASSERT_EQUAL_UINT32(1090, anchors.timestampOf(19));
+}
+
+// Sequence numbers wrap at 2^32 like every counter in the history
+void test_timestamp_across_wrap(void) {
+  TimeAnchors<4> anchors;
+  anchors.add(anchor(0xFFFFFFFE, 100, 10));
+  anchors.add(anchor(2, 200, 10));
+  TEST_ASSERT_EQUAL_UINT32(110, anchors.timestampOf(0xFFFFFFFF));
+  TEST_ASSERT_EQUAL_UINT32(130, anchors.timestampOf(1));
+  TEST_ASSERT_EQUAL_UINT32(210, anchors.timestampOf(3));
+}
+
+void test_needs_anchor(void) {
+  TimeAnchors<4> anchors;
+  anchors.add(anchor(0, 1000, 10));
+  TEST_ASSERT_FALSE(anchors.needsAnchor(3, 1030, 10));
+  TEST_ASSERT_FALSE(anchors.needsAnchor(3, 1030 + ANCHOR_TOLERANCE_MINUTES, 10));
+  TEST_ASSERT_TRUE(anchors.needsAnchor(3, 1030 + ANCHOR_TOLERANCE_MINUTES + 1, 10));
+  TEST_ASSERT_TRUE(anchors.needsAnchor(3, 1030, 5));
+}
+
+// Records 100..109 at minutes 1000, 1010, ... 1090, with `missing` no
+// longer held
+static uint32_t missing = 0;
+
+static bool tierTimestamp(uint32_t sequence, uint32_t& timestamp) {
+  if (sequence < 100 || sequence >= 110 || sequence == missing) return false;
+  timestamp = 1000 + (sequence - 100) * 10;
+  return true;
+}
+
+static uint32_t find(uint32_t minute) {
+  uint32_t scanned = 0;
+  return findFirstAtOrAfter(100, 110, minute, scanned, tierTimestamp);
+}
+
+void test_find_at_window_edges(void) {
+  missing = 0;
+  TEST_ASSERT_EQUAL_UINT32(100, find(0));      // Before the window: all of it
+  TEST_ASSERT_EQUAL_UINT32(100, find(1000));   // On the oldest record
+  TEST_ASSERT_EQUAL_UINT32(101, find(1001));
+  TEST_ASSERT_EQUAL_UINT32(105, find(1050));   // Exact match
+  TEST_ASSERT_EQUAL_UINT32(106, find(1051));   // Between records
+  TEST_ASSERT_EQUAL_UINT32(109, find(1090));   // On the newest record
+  TEST_ASSERT_EQUAL_UINT32(110, find(1091));   // After the window: nothing
+}
+
+void test_find_empty_range(void) {
+  uint32_t scanned = 0;
+  TEST_ASSERT_EQUAL_UINT32(100, findFirstAtOrAfter(100, 100, 1000, scanned, tierTimestamp));
+  TEST_ASSERT_EQUAL_UINT32(0, scanned);
+}
+
+// A record overwritten during the search counts as older than any minute
+void test_find_skips_missing_oldest(void) {
+  missing = 100;
+  TEST_ASSERT_EQUAL_UINT32(101, find(0));
+  TEST_ASSERT_EQUAL_UINT32(101, find(1000));
+  TEST_ASSERT_EQUAL_UINT32(102, find(1020));
+  missing = 0;
+}
+
+void test_find_probes_logarithmically(void) {
+  uint32_t scanned = 0;
+  findFirstAtOrAfter(100, 110, 1055, scanned, tierTimestamp);
+  TEST_ASSERT_TRUE(scanned <= 4);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_no_anchors);
+  RUN_TEST(test_timestamp_across_anchors);
+  RUN_TEST(test_timestamp_before_oldest_anchor);
+  RUN_TEST(test_timestamp_across_wrap);
+  RUN_TEST(test_needs_anchor);
+  RUN_TEST(test_find_at_window_edges);
+  RUN_TEST(test_find_empty_range);
+  RUN_TEST(test_find_skips_missing_oldest);
+  RUN_TEST(test_find_probes_logarithmically);
+  return UNITY_END();
+}
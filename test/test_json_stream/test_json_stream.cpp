@@ -0,0 +1,102 @@
+// JsonArrayStream: the same document whatever chunk size the server asks for
+
+#include <unity.h>
+#include <stdio.h>
+#include <string>
+#include "JsonStream.h"
+
+#define PREFIX "{\"res\":\"raw\",\"first\":4294967290,\"data\":["
+#define SUFFIX "]}"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Every record but multiples of 7, which are "no longer held"
+static size_t formatRecord(char* out, size_t size, uint32_t sequence, void*) {
+  if (sequence % 7 == 0) return 0;
+  int len = snprintf(out, size, "{\"t\":%lu,\"v\":%.1f}", (unsigned long)sequence, (sequence % 1000) / 10.0);
+  return len > 0 ? len : 0;
+}
+
+static std::string expectedDocument(uint32_t first, uint32_t end, uint32_t step) {
+  std::string document = PREFIX;
+  bool firstRecord = true;
+  for (uint32_t sequence = first; sequence != end && (int32_t)(end - sequence) > 0; sequence += step) {
+    char record[64];
+    if (formatRecord(record, sizeof(record), sequence, NULL) == 0) continue;
+    if (!firstRecord) document += ",";
+    firstRecord = false;
+    document += record;
+  }
+  return document + SUFFIX;
+}
+
+static std::string streamDocument(uint32_t first, uint32_t end, uint32_t step, size_t chunk) {
+  JsonArrayStream stream(PREFIX, SUFFIX, formatRecord, NULL, first, end);
+  stream.setStep(step);
+  std::string document;
+  uint8_t buffer[512];
+  size_t n;
+  while ((n = stream.read(buffer, chunk)) > 0) {
+    TEST_ASSERT_TRUE(n <= chunk);
+    document.append((const char*)buffer, n);
+  }
+  TEST_ASSERT_TRUE(stream.done());
+  TEST_ASSERT_EQUAL_size_t(0, stream.read(buffer, chunk));
+  return document;
+}
+
+// Chunks smaller than one record, around the scratch size and larger than
+// the document, with sequence numbers wrapping part way
+void test_chunk_sizes(void) {
+  uint32_t first = 4294967290u;
+  uint32_t end = first + 200;
+  std::string whole = expectedDocument(first, end, 1);
+  for (size_t chunk = 1; chunk <= 300; chunk++) {
+    std::string streamed = streamDocument(first, end, 1, chunk);
+    TEST_ASSERT_EQUAL_size_t(whole.size(), streamed.size());
+    TEST_ASSERT_EQUAL_STRING(whole.c_str(), streamed.c_str());
+  }
+  TEST_ASSERT_EQUAL_STRING(whole.c_str(), streamDocument(first, end, 1, 512).c_str());
+}
+
+void test_step(void) {
+  for (uint32_t step = 2; step <= 9; step++) {
+    std::string whole = expectedDocument(1000, 1100, step);
+    for (size_t chunk = 1; chunk <= 64; chunk += 7) {
+      TEST_ASSERT_EQUAL_STRING(whole.c_str(), streamDocument(1000, 1100, step, chunk).c_str());
+    }
+  }
+}
+
+void test_empty(void) {
+  TEST_ASSERT_EQUAL_STRING(PREFIX SUFFIX, streamDocument(50, 50, 1, 3).c_str());
+  // Nothing but skipped records
+  TEST_ASSERT_EQUAL_STRING(PREFIX SUFFIX, streamDocument(70, 71, 1, 3).c_str());
+}
+
+static size_t formatSuffix(char* out, size_t size, void*) {
+  int len = snprintf(out, size, "],\"scanned\":%d}", 42);
+  return len > 0 ? len : 0;
+}
+
+void test_suffix_formatter(void) {
+  JsonArrayStream stream(PREFIX, SUFFIX, formatRecord, NULL, 1, 3);
+  stream.setSuffixFormatter(formatSuffix);
+  std::string document;
+  uint8_t buffer[5];
+  size_t n;
+  while ((n = stream.read(buffer, sizeof(buffer))) > 0) {
+    document.append((const char*)buffer, n);
+  }
+  TEST_ASSERT_EQUAL_STRING(PREFIX "{\"t\":1,\"v\":0.1},{\"t\":2,\"v\":0.2}],\"scanned\":42}", document.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_chunk_sizes);
+  RUN_TEST(test_step);
+  RUN_TEST(test_empty);
+  RUN_TEST(test_suffix_formatter);
+  return UNITY_END();
+}
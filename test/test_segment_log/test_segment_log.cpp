@@ -0,0 +1,167 @@
+// SegmentLog and DeltaSegmentLog: reopening after a torn final record keeps
+// every whole record and continues in a fresh segment
+
+#include <unity.h>
+#include <Arduino.h>
+#include <FS.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "SegmentLog.h"
+#include "DeltaSegmentLog.h"
+
+#define LOG_DIR "/log"
+#define PER_SEGMENT 4
+#define SEGMENTS 3
+
+struct TestRecord {
+  uint32_t index;
+  uint32_t check;
+};
+
+static char root[64];
+static fs::FS hostFS;
+
+void setUp(void) {
+  strcpy(root, "/tmp/segmentlogXXXXXX");
+  TEST_ASSERT_TRUE(mkdtemp(root) != NULL);
+  TEST_ASSERT_TRUE(hostFS.begin(root));
+}
+
+void tearDown(void) {
+  for (int slot = 0; slot < SEGMENTS; slot++) {
+    hostFS.remove(String(LOG_DIR) + "/" + String(slot) + ".seg");
+  }
+  rmdir((std::string(root) + LOG_DIR).c_str());
+  rmdir(root);
+}
+
+static String slotPath(uint32_t sequence) {
+  return String(LOG_DIR) + "/" + String((unsigned long)(sequence % SEGMENTS)) + ".seg";
+}
+
+static std::string readFile(const String& path) {
+  File file = hostFS.open(path, "r");
+  std::string bytes(file.size(), '\0');
+  file.read((uint8_t*)&bytes[0], bytes.size());
+  return bytes;
+}
+
+static void writeFile(const String& path, const std::string& bytes) {
+  File file = hostFS.open(path, "w");
+  file.write((const uint8_t*)bytes.data(), bytes.size());
+}
+
+static TestRecord makeRecord(uint32_t index) {
+  TestRecord record = {index, index * 2654435761u};
+  return record;
+}
+
+static PackedPoint makePoint(uint32_t index) {
+  PackedPoint point;
+  point.voltage = 1200 + (index * 37) % 300;
+  point.current = (int16_t)((index % 2) ? -20000 + index : 150 - index);  // Long deltas too
+  point.soc = 100 + index % 100;
+  return point;
+}
+
+// Appending a partial record to the active segment, as a power cut during
+// append() would
+void test_segment_log_torn_tail(void) {
+  SegmentLog log(hostFS, LOG_DIR, sizeof(TestRecord), PER_SEGMENT, SEGMENTS);
+  log.begin();
+  for (uint32_t i = 0; i < 6; i++) {
+    TestRecord record = makeRecord(i);
+    TEST_ASSERT_TRUE(log.append(&record));
+  }
+  String active = slotPath(1);  // Records 4 and 5
+  std::string bytes = readFile(active);
+  TestRecord torn = makeRecord(6);
+  writeFile(active, bytes + std::string((const char*)&torn, 3));
+
+  SegmentLog reopened(hostFS, LOG_DIR, sizeof(TestRecord), PER_SEGMENT, SEGMENTS);
+  TEST_ASSERT_TRUE(reopened.begin());
+  TEST_ASSERT_EQUAL_UINT32(6, reopened.recordCount());
+  TestRecord next = makeRecord(6);
+  TEST_ASSERT_TRUE(reopened.append(&next));
+
+  std::vector<uint32_t> seen;
+  reopened.forEach([&](const void* data, uint32_t index) {
+    TestRecord record;
+    memcpy(&record, data, sizeof(record));
+    TEST_ASSERT_EQUAL_UINT32(index, record.index);
+    TEST_ASSERT_EQUAL_UINT32(makeRecord(index).check, record.check);
+    seen.push_back(index);
+  });
+  TEST_ASSERT_EQUAL_size_t(7, seen.size());
+  for (uint32_t i = 0; i < seen.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(i, seen[i]);
+  }
+  reopened.clear();
+}
+
+// Cutting the last delta-coded point short, at every length it could stop at
+void test_delta_segment_log_torn_tail(void) {
+  for (size_t cut = 1; cut < 3; cut++) {
+    DeltaSegmentLog log(hostFS, LOG_DIR, PER_SEGMENT, SEGMENTS);
+    log.begin();
+    log.clear();
+    for (uint32_t i = 0; i < 7; i++) {
+      TEST_ASSERT_TRUE(log.append(makePoint(i)));
+    }
+    String active = slotPath(1);  // Points 4 to 6
+    std::string bytes = readFile(active);
+    writeFile(active, bytes.substr(0, bytes.size() - cut));
+
+    DeltaSegmentLog reopened(hostFS, LOG_DIR, PER_SEGMENT, SEGMENTS);
+    TEST_ASSERT_TRUE(reopened.begin());
+    TEST_ASSERT_EQUAL_UINT32(6, reopened.recordCount());
+    TEST_ASSERT_TRUE(reopened.append(makePoint(6)));
+    TEST_ASSERT_TRUE(reopened.append(makePoint(7)));
+    TEST_ASSERT_EQUAL_UINT32(8, reopened.recordCount());
+
+    uint32_t expected = 0;
+    reopened.forEach([&](const PackedPoint& point, uint32_t index) {
+      TEST_ASSERT_EQUAL_UINT32(expected, index);
+      TEST_ASSERT_EQUAL_UINT16(makePoint(index).voltage, point.voltage);
+      TEST_ASSERT_EQUAL_INT16(makePoint(index).current, point.current);
+      TEST_ASSERT_EQUAL_UINT8(makePoint(index).soc, point.soc);
+      expected++;
+    });
+    TEST_ASSERT_EQUAL_UINT32(8, expected);
+
+    DeltaSegmentLog::Reader reader(reopened);
+    for (uint32_t index = reopened.oldestRecord(); index != reopened.recordCount(); index++) {
+      PackedPoint point;
+      TEST_ASSERT_TRUE(reader.read(index, point));
+      TEST_ASSERT_EQUAL_INT16(makePoint(index).current, point.current);
+    }
+    reopened.clear();
+  }
+}
+
+// Once the log wraps, recycled records are gone: a Reader does not decode
+// the segment now in their slot as old history
+void test_delta_segment_log_recycled(void) {
+  DeltaSegmentLog log(hostFS, LOG_DIR, PER_SEGMENT, SEGMENTS);
+  log.begin();
+  for (uint32_t i = 0; i < 4; i++) log.append(makePoint(i));
+  DeltaSegmentLog::Reader reader(log);
+  PackedPoint point;
+  TEST_ASSERT_TRUE(reader.read(1, point));
+
+  for (uint32_t i = 4; i < 14; i++) log.append(makePoint(i));  // Segment 0 is recycled as 3
+  TEST_ASSERT_EQUAL_UINT32(PER_SEGMENT, log.oldestRecord());
+  TEST_ASSERT_FALSE(reader.read(2, point));
+  TEST_ASSERT_TRUE(reader.read(12, point));
+  TEST_ASSERT_EQUAL_INT16(makePoint(12).current, point.current);
+  log.clear();
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_segment_log_torn_tail);
+  RUN_TEST(test_delta_segment_log_torn_tail);
+  RUN_TEST(test_delta_segment_log_recycled);
+  return UNITY_END();
+}
@@ -0,0 +1,145 @@
+// SocStore: the newest good slot wins, a torn or corrupted one is skipped
+
+#include <unity.h>
+#include <Arduino.h>
+#include <FS.h>
+#include <unistd.h>
+#include <string>
+#include "SocStore.h"
+
+#define SLOT0 "/soc0.bin"
+#define SLOT1 "/soc1.bin"
+
+static char root[64];
+static fs::FS hostFS;
+
+void setUp(void) {
+  strcpy(root, "/tmp/socstoreXXXXXX");
+  TEST_ASSERT_TRUE(mkdtemp(root) != NULL);
+  TEST_ASSERT_TRUE(hostFS.begin(root));
+}
+
+void tearDown(void) {
+  hostFS.remove(SLOT0);
+  hostFS.remove(SLOT1);
+  rmdir(root);
+}
+
+static SocState makeState(float soc) {
+  SocState state;
+  memset(&state, 0, sizeof(state));
+  state.chargedMaUs = 123456789012LL;
+  state.dischargedMaUs = 98765432109LL;
+  state.socPercentage = soc;
+  state.ampHoursRemaining = soc * 3.0f;
+  state.lastFullTime = SOC_NEVER_FULL;
+  return state;
+}
+
+static std::string readFile(const char* path) {
+  File file = hostFS.open(path, "r");
+  std::string bytes(file.size(), '\0');
+  file.read((uint8_t*)&bytes[0], bytes.size());
+  return bytes;
+}
+
+static void writeFile(const char* path, const std::string& bytes) {
+  File file = hostFS.open(path, "w");
+  file.write((const uint8_t*)bytes.data(), bytes.size());
+}
+
+void test_empty_store_loads_nothing(void) {
+  SocStore store(hostFS, SLOT0, SLOT1);
+  SocState state;
+  TEST_ASSERT_FALSE(store.load(state));
+}
+
+void test_newest_slot_wins(void) {
+  SocStore writer(hostFS, SLOT0, SLOT1);
+  TEST_ASSERT_TRUE(writer.save(makeState(50.0)));
+  TEST_ASSERT_TRUE(writer.save(makeState(60.0)));
+  TEST_ASSERT_TRUE(writer.save(makeState(70.0)));
+
+  SocStore reader(hostFS, SLOT0, SLOT1);
+  SocState state;
+  TEST_ASSERT_TRUE(reader.load(state));
+  TEST_ASSERT_EQUAL_FLOAT(70.0, state.socPercentage);
+  TEST_ASSERT_EQUAL_INT64(123456789012LL, state.chargedMaUs);
+  TEST_ASSERT_EQUAL_UINT32(2, reader.getSequence());
+}
+
+// A power cut part way through the newest write leaves a short file
+void test_torn_slot_falls_back(void) {
+  SocStore writer(hostFS, SLOT0, SLOT1);
+  writer.save(makeState(50.0));   // Slot 0
+  writer.save(makeState(60.0));   // Slot 1
+  std::string newest = readFile(SLOT1);
+  writeFile(SLOT1, newest.substr(0, newest.size() / 2));
+
+  SocStore reader(hostFS, SLOT0, SLOT1);
+  SocState state;
+  TEST_ASSERT_TRUE(reader.load(state));
+  TEST_ASSERT_EQUAL_FLOAT(50.0, state.socPercentage);
+  TEST_ASSERT_EQUAL_UINT32(0, reader.getSequence());
+}
+
+// A whole record whose CRC does not match, e.g. a flipped bit
+void test_bad_crc_falls_back(void) {
+  SocStore writer(hostFS, SLOT0, SLOT1);
+  writer.save(makeState(50.0));
+  writer.save(makeState(60.0));
+  std::string newest = readFile(SLOT1);
+  newest[offsetof(SocRecord, state) + offsetof(SocState, socPercentage)] ^= 0x01;
+  writeFile(SLOT1, newest);
+
+  SocStore reader(hostFS, SLOT0, SLOT1);
+  SocState state;
+  TEST_ASSERT_TRUE(reader.load(state));
+  TEST_ASSERT_EQUAL_FLOAT(50.0, state.socPercentage);
+}
+
+// After recovering, the next save goes over the damaged slot and
+// continues the sequence, so the good copy survives that write too
+void test_save_after_recovery_overwrites_bad_slot(void) {
+  SocStore writer(hostFS, SLOT0, SLOT1);
+  writer.save(makeState(50.0));
+  writer.save(makeState(60.0));
+  writeFile(SLOT1, readFile(SLOT1).substr(0, 7));
+
+  SocStore reader(hostFS, SLOT0, SLOT1);
+  SocState state;
+  TEST_ASSERT_TRUE(reader.load(state));
+  std::string good = readFile(SLOT0);
+  TEST_ASSERT_TRUE(reader.save(makeState(55.0)));
+  TEST_ASSERT_TRUE(good == readFile(SLOT0));
+
+  SocStore again(hostFS, SLOT0, SLOT1);
+  TEST_ASSERT_TRUE(again.load(state));
+  TEST_ASSERT_EQUAL_FLOAT(55.0, state.socPercentage);
+  TEST_ASSERT_EQUAL_UINT32(1, again.getSequence());
+}
+
+void test_both_slots_bad_loads_nothing(void) {
+  SocStore writer(hostFS, SLOT0, SLOT1);
+  writer.save(makeState(50.0));
+  writer.save(makeState(60.0));
+  writeFile(SLOT0, "");
+  std::string newest = readFile(SLOT1);
+  newest[offsetof(SocRecord, crc)] ^= 0xFF;  // The CRC itself
+  writeFile(SLOT1, newest);
+
+  SocStore reader(hostFS, SLOT0, SLOT1);
+  SocState state;
+  TEST_ASSERT_FALSE(reader.load(state));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_store_loads_nothing);
+  RUN_TEST(test_newest_slot_wins);
+  RUN_TEST(test_torn_slot_falls_back);
+  RUN_TEST(test_bad_crc_falls_back);
+  RUN_TEST(test_save_after_recovery_overwrites_bad_slot);
+  RUN_TEST(test_both_slots_bad_loads_nothing);
+  return UNITY_END();
+}